@@ -12,97 +12,91 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <stdio.h>
-
-#define BUF_SIZE 64
-
-/*前向声明*/
-class UtilTimer;
-
-/*用户数据结构：客户端socket地址、socket文件描述符、读缓存和定时器*/
-struct ClientData
-{
-    sockaddr_in clntAddr;
-    int clntsock;
-    char readBuffer[BUF_SIZE];
-    UtilTimer *timer;
-};
-
-/*定时器类*/
-class UtilTimer
-{
-    friend class SortListTimer;     //声明友元类，以便访问私有数据
-public:
-    /*默认构造函数*/
-    UtilTimer() : expire(0), userData(nullptr), prev(nullptr), next(nullptr) { }
-    /*任务回调函数*/
-    void (*callback)(ClientData *); 
-    
-
-public:
-    time_t expire;          //任务的超时时间，使用的是绝对时间
-    ClientData *userData;   //回调函数处理的客户数据，由定时器的调用者传递给回调函数
-    UtilTimer *prev;        //前一个定时器
-    UtilTimer *next;        //后一个定时器
-};
+#include "TimerQueue.h"
 
 /*
  * 定时器链表：是一个升序的双向链表，且带有头结点和尾结点
  */
-class SortListTimer
+class SortListTimer : public TimerQueue
 {
 public:
     /*默认构造函数*/
     SortListTimer() : head(nullptr), tail(nullptr) { }
     /*析构函数*/
     ~SortListTimer();
-    /*添加定时器*/
-    void AddTimer(UtilTimer *timer);
-    /*调整定时器位置*/
-    void AdjustTimer(UtilTimer *timer);
+    /*把定时器添加到链表中*/
+    void AddTimer(TimerNode *timer, ClientData *userData, int64_t expire, TimerCallBack callback);
+    /*修改超时时间并调整定时器位置*/
+    void AdjustTimer(TimerNode *timer, int64_t expire);
     /*删除目标定时器*/
-    void DeleteTimer(UtilTimer *timer);
-    /*心跳函数*/
+    void DeleteTimer(TimerNode *timer);
+    /*心跳函数：打印一行提示后处理当前时刻到期的定时器*/
     void Tick();
+    /*处理超时时间不晚于now的定时器*/
+    void TickTo(int64_t now);
+    /*链表头就是最早到期的定时器*/
+    int64_t NextExpire() const { return head ? head->expire : -1; }
 
 private:
-    void AddTimer(UtilTimer *timer, UtilTimer *lstHead);
+    /*添加定时器*/
+    void AddTimer(TimerNode *timer);
+    void AddTimer(TimerNode *timer, TimerNode *lstHead);
+    /*把定时器从链表中摘下*/
+    void RemoveTimer(TimerNode *timer);
 
 private:
-    UtilTimer *head;
-    UtilTimer *tail;
+    TimerNode *head;
+    TimerNode *tail;
 };
 
 /*
- * 链表被销毁时，删除其中所有的定时器
+ * 链表被销毁时，摘下其中所有的定时器，结点的内存属于调用者
  */
 SortListTimer::~SortListTimer()
 {
-    UtilTimer *tmp = head;
-    while (tmp)
+    while (head)
     {
-        head = tmp->next;
-        delete tmp;
-        tmp = head;
+        RemoveTimer(head);
     }
 }
 
 /*
- * 将目标定时器添加到链表中
+ * 绑定用户数据和回调函数后把定时器加入链表
  */
-void SortListTimer::AddTimer(UtilTimer *timer)
+void SortListTimer::AddTimer(TimerNode *timer, ClientData *userData, int64_t expire, TimerCallBack callback)
 {
     if (!timer)
     {
         return;
     }
+    timer->userData = userData;
+    timer->callback = callback;
+    if (timer->pending)
+    {
+        AdjustTimer(timer, expire);
+        return;
+    }
+    /*按slack推迟到对齐的时刻，相近的定时器超时时间相同，由同一次Tick处理*/
+    timer->expire = ApplySlack(expire, timer->slack);
+    AddTimer(timer);
+}
+
+/*
+ * 将目标定时器添加到链表中
+ */
+void SortListTimer::AddTimer(TimerNode *timer)
+{
+    timer->pending = true;
     if (!head)
     {
+        timer->prev = timer->next = nullptr;
         head = tail = timer;
         return;
     }
     /*如果目标定时器的超时时间小于表头，则把目标定时器插入表头*/
     if (timer->expire < head->expire)
     {
+        timer->prev = nullptr;
         timer->next = head;
         head->prev = timer;
         head = timer;
@@ -113,80 +107,74 @@ void SortListTimer::AddTimer(UtilTimer *timer)
 }
 
 /*
- * 当某个定时任务发生变化时，其定时器在链表中的位置也会发生改变，这里只考虑定时时间增加的情况，即目标定时器向后调整
- * 考虑3种情况：1、当目标定时器本来就在链尾，2、变化后还是小于原来的下一个结点，则不用调整
- * 3、如果目标定时器原本是表头，则还需要额外操作
- * 4、剩下的情况，需要把目标定时器拿出来，还要串联目标定时器原来的前后结点，再插入到合适位置
+ * 当某个定时任务发生变化时，其定时器在链表中的位置也会发生改变
+ * 考虑3种情况：1、定时时间增加后，目标定时器本来就在链尾，或者仍然小于原来的下一个结点，则不用调整
+ * 2、定时时间减少后，仍然不小于原来的前一个结点，也不用调整
+ * 3、剩下的情况，需要把目标定时器拿出来，串联目标定时器原来的前后结点，再插入到合适位置
  */
-void SortListTimer::AdjustTimer(UtilTimer *timer)
+void SortListTimer::AdjustTimer(TimerNode *timer, int64_t expire)
 {
-    UtilTimer *tmp = timer->next;
-    if (!timer)
+    if (!timer || !timer->pending)
     {
         return;
     }
+    timer->expire = ApplySlack(expire, timer->slack);
     //情况1，2
-    if (timer == tail || timer->expire < tmp->expire)
+    if ((!timer->next || timer->expire < timer->next->expire) &&
+        (!timer->prev || timer->expire >= timer->prev->expire))
     {
         return;
     }
     //情况3
-    if (timer == head)
-    {
-        head = head->next;
-        head->prev = nullptr;
-        timer->next = nullptr;
-        AddTimer(timer, head);
-    }
-    //情况4
-    else
-    {
-        timer->prev->next = tmp;
-        tmp->prev = timer->prev;
-        AddTimer(timer, tmp);
-    }
-
+    RemoveTimer(timer);
+    AddTimer(timer);
 }
 
 /*
  * 从链表中删除目标定时器
- * 考虑4种情况：1、链表中没有结点：直接返回；2、链表中只有一个结点：删完之后要置nullptr；3、删除的是头/尾结点：删完之后更新头/尾结点；
- * 4、其他情况:删完要串起前后结点
  */
-void SortListTimer::DeleteTimer(UtilTimer *timer)
+void SortListTimer::DeleteTimer(TimerNode *timer)
 {
-    //情况1
-    if (!timer || !head)
+    if (!timer || !timer->pending)
     {
         return;
     }
-    //情况2
+    RemoveTimer(timer);
+}
+
+/*
+ * 把目标定时器从链表中摘下
+ * 考虑3种情况：1、链表中只有一个结点：摘完之后要置nullptr；2、摘的是头/尾结点：摘完之后更新头/尾结点；
+ * 3、其他情况:摘完要串起前后结点
+ */
+void SortListTimer::RemoveTimer(TimerNode *timer)
+{
+    //情况1
     if (head == timer && tail == timer)
     {
-        delete timer;
         head = nullptr;
         tail = nullptr;
-        return;
     }
-    //情况3
-    if (timer == head)
+    //情况2
+    else if (timer == head)
     {
         head = head->next;
         head->prev = nullptr;
-        delete timer;
-        return;
     }
-    if (timer == tail)
+    else if (timer == tail)
     {
         tail = tail->prev;
         tail->next = nullptr;
-        delete timer;
-        return;
     }
-    //情况4
-    timer->prev->next = timer->next;
-    timer->next->prev = timer->prev;
-    delete timer;
+    //情况3
+    else
+    {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    timer->pending = false;
 }
 
 /*
@@ -199,36 +187,40 @@ void SortListTimer::DeleteTimer(UtilTimer *timer)
         return;
      }
     printf("timer tick\n");
-    time_t curTime = time(NULL);
-    UtilTimer *tmp = head;
+    TickTo(GetCurrentMs());
+ }
+
+/*
+ * 从链表头开始执行超时时间不晚于now的定时任务
+ */
+ void SortListTimer::TickTo(int64_t now)
+ {
+    TimerNode *tmp = head;
      
      /*从头结点开始依次处理定时事件，直到遇到未到期的定时器为止*/
      while (tmp)
      {
          /*因为定时器使用的是绝对时间，所以可以直接进行比较*/
-         if (curTime < tmp->expire)
+         if (now < tmp->expire)
          {
              break;
          }
-         /*调用定时器的回调函数，执行定时任务*/
-         tmp->callback(tmp->userData);
-         /*执行完定时任务后，将其从链表中删除，并重置头结点*/
-         head = tmp->next;
-         if (head)
+         /*先将其从链表中摘下，再调用定时器的回调函数执行定时任务，这样回调中可以安全地增删其他定时器*/
+         RemoveTimer(tmp);
+         if (tmp->callback)
          {
-            head->prev = nullptr;
+            tmp->callback(tmp->userData);
          }
-        delete tmp;
         tmp = head;
      }
  }
 
 /*
- * 重载的结点移动函数，目标结点不是头尾结点
+ * 重载的结点移动函数，从lstHead开始向后找到第一个超时时间大于目标定时器的结点，插在它前面
  */
- void SortListTimer::AddTimer(UtilTimer *timer, UtilTimer *lstHead)
+ void SortListTimer::AddTimer(TimerNode *timer, TimerNode *lstHead)
  {
-    while (timer->expire >= lstHead->expire && lstHead)
+    while (lstHead && timer->expire >= lstHead->expire)
     {
         lstHead = lstHead->next;
     }
@@ -236,6 +228,14 @@ void SortListTimer::DeleteTimer(UtilTimer *timer)
     {
         timer->next = lstHead;
         timer->prev = lstHead->prev;
+        if (lstHead->prev)
+        {
+            lstHead->prev->next = timer;
+        }
+        else
+        {
+            head = timer;
+        }
         lstHead->prev = timer;
     }
     else        //插入链表尾部
@@ -0,0 +1,130 @@
+/* ************************************************************************
+> File Name:     BufferPool.h
+> Author:        Luncles
+> 功能：          每个线程一个的I/O缓冲区池，按2的幂大小分级回收缓冲区
+> Created Time:  Mon 26 Oct 2026 10:17:08 AM CST
+> Description:   输入缓冲区在一批数据读完后就释放，下一次可读时再申请，每次都走malloc/free不仅慢，
+                 拿到的内存也往往不在缓存中。缓冲区池按4KB、8KB……64KB分级，每级一个后进先出的空闲链表，
+                 刚归还的缓冲区最先被再次使用，它的内容很可能还在CPU缓存里。
+                 池是线程局部的，取还都不加锁；在一个线程取、在另一个线程还的缓冲区归入还的那个线程的池。
+                 每级最多缓存POOL_CLASS_BYTES字节，超过时直接free，一个只还不取的线程不会无限囤积内存。
+                 缓冲区的内容不会被清零，使用者必须自己记录有效数据的长度。
+ ************************************************************************/
+
+#ifndef BUFFER_POOL
+#define BUFFER_POOL
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#define POOL_MIN_SIZE 4096                  //最小一级的大小
+#define POOL_CLASSES 5                      //4KB、8KB、16KB、32KB、64KB
+#define POOL_CLASS_BYTES (1024 * 1024)      //每级最多缓存的字节数
+
+class BufferPool
+{
+public:
+    BufferPool();
+    ~BufferPool();
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    /*本线程的缓冲区池*/
+    static BufferPool &Local();
+    /*取一个至少size字节的缓冲区，内容是上一个使用者留下的。超过最大一级时直接malloc，失败时返回nullptr*/
+    char *Get(size_t size);
+    /*归还Get(size)取到的缓冲区，size必须与取时相同*/
+    void Put(char *buffer, size_t size);
+
+private:
+    /*size所在的级别，超过最大一级时返回-1*/
+    static int ClassOf(size_t size);
+
+private:
+    /*空闲的缓冲区本身充当链表结点*/
+    struct FreeBuffer
+    {
+        FreeBuffer *next;
+    };
+    FreeBuffer *freeLists[POOL_CLASSES];
+    size_t cachedBytes[POOL_CLASSES];
+};
+
+inline BufferPool::BufferPool()
+{
+    for (int i = 0; i < POOL_CLASSES; i++)
+    {
+        freeLists[i] = nullptr;
+        cachedBytes[i] = 0;
+    }
+}
+
+inline BufferPool::~BufferPool()
+{
+    for (int i = 0; i < POOL_CLASSES; i++)
+    {
+        while (freeLists[i])
+        {
+            FreeBuffer *buffer = freeLists[i];
+            freeLists[i] = buffer->next;
+            free(buffer);
+        }
+    }
+}
+
+inline BufferPool &BufferPool::Local()
+{
+    static thread_local BufferPool pool;
+    return pool;
+}
+
+inline int BufferPool::ClassOf(size_t size)
+{
+    int index = 0;
+    size_t classSize = POOL_MIN_SIZE;
+    while (classSize < size)
+    {
+        classSize <<= 1;
+        index++;
+    }
+    return (index < POOL_CLASSES) ? index : -1;
+}
+
+inline char *BufferPool::Get(size_t size)
+{
+    int index = ClassOf(size);
+    if (index < 0)
+    {
+        return (char *)malloc(size);
+    }
+    FreeBuffer *buffer = freeLists[index];
+    if (buffer)
+    {
+        freeLists[index] = buffer->next;
+        cachedBytes[index] -= (size_t)POOL_MIN_SIZE << index;
+        return (char *)buffer;
+    }
+    /*按级别的大小分配，同一级的缓冲区可以互相替代*/
+    return (char *)malloc((size_t)POOL_MIN_SIZE << index);
+}
+
+inline void BufferPool::Put(char *buffer, size_t size)
+{
+    if (!buffer)
+    {
+        return;
+    }
+    int index = ClassOf(size);
+    size_t classSize = (size_t)POOL_MIN_SIZE << ((index < 0) ? 0 : index);
+    if ((index < 0) || (cachedBytes[index] + classSize > POOL_CLASS_BYTES))
+    {
+        free(buffer);
+        return;
+    }
+    FreeBuffer *node = (FreeBuffer *)buffer;
+    node->next = freeLists[index];
+    freeLists[index] = node;
+    cachedBytes[index] += classSize;
+}
+
+#endif
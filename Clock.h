@@ -0,0 +1,54 @@
+/* ************************************************************************
+> File Name:     Clock.h
+> Author:        Luncles
+> 功能：          事件循环缓存的单调毫秒时钟，所有定时器都以它为基准
+> Created Time:  Fri 23 Oct 2026 09:12:36 AM CST
+> Description:   定时器的超时时间是CLOCK_MONOTONIC的毫秒数，不受修改系统时间和NTP跳变的影响。
+                 每个事件循环线程在epoll_wait返回后调用一次UpdateLoopClock读时钟，本轮中的定时器操作
+                 （添加、调整、心跳）都用GetCurrentMs取这个缓存值，一轮中刷新再多的定时器也只读一次时钟。
+                 缓存是线程局部的，多个事件循环线程互不影响；从没更新过的线程第一次调用GetCurrentMs时读一次时钟。
+                 没有用CLOCK_MONOTONIC_COARSE：它的精度是一个内核节拍（通常4毫秒），配不上1毫秒的时间轮，
+                 而每轮只读一次，两者的开销差别可以忽略。
+ ************************************************************************/
+
+#ifndef LOOP_CLOCK
+#define LOOP_CLOCK
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * 直接读单调时钟，以毫秒为单位
+ */
+inline int64_t MonotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*本线程缓存的时间，0表示还没有读过*/
+inline int64_t &LoopClockMs()
+{
+    static thread_local int64_t nowMs = 0;
+    return nowMs;
+}
+
+/*
+ * 读一次单调时钟并更新本线程的缓存，每轮事件循环在epoll_wait返回后调用
+ */
+inline int64_t UpdateLoopClock()
+{
+    return LoopClockMs() = MonotonicMs();
+}
+
+/*
+ * 以毫秒为单位的当前时间（本轮事件循环开始时的单调时钟），所有定时器的超时时间都以它为基准
+ */
+inline int64_t GetCurrentMs()
+{
+    int64_t &nowMs = LoopClockMs();
+    return nowMs ? nowMs : (nowMs = MonotonicMs());
+}
+
+#endif
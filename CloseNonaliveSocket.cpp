@@ -1,7 +1,7 @@
 /* ************************************************************************
 > File Name:     CloseNonaliveSocket.cpp
 > Author:        Luncles
-> 功能：          利用升序定时器链表关闭非活动连接
+> 功能：          利用定时器队列（升序链表、时间轮或时间堆）关闭非活动连接
 > Created Time:  Fri 26 May 2023 09:28:29 PM CST
 > Description:   
  ************************************************************************/
@@ -17,227 +17,371 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
-#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 #include <pthread.h>
 #include <unistd.h>
-#include "AscendingListTimer.h"
+#include "TimerQueue.h"
 #include "init_socket.h"
+#include "ConnectionTable.h"
+#include "Histogram.h"
+#include "EventLoop.h"
+
+/*
+ * 客户连接：连接表的表项，定时器和客户数据在ClientData中，事件处理器是它的基类。
+ * 连接关闭后到本轮结束才释放表项，本轮后面的事件不会访问已经归还的内存
+ */
+struct Client : public EventHandler
+{
+    ClientData data;
+    bool peerClosed;        //对端已经关闭写（EPOLLRDHUP），输入缓冲区没读满也要再读一次，读到0后关闭
+
+    Client() : peerClosed(false) { }
+
+    /*客户连接有数据接收，放进就绪列表*/
+    virtual void HandleEvent(uint32_t events);
+    /*读一次数据，输入缓冲区读满时返回true，下一轮接着读*/
+    virtual bool HandleReady();
+    /*描述符已经关闭，释放连接表中的表项*/
+    virtual void OnClosed();
+};
 
 /*尽量以const代替#define */
-const int MAX_EVENT_NUMBER = 1024;
-const int FD_LIMIT =  65535;
-const int TIMESLOT = 5;                 //定时时长
-static int pipefd[2];
-static SortListTimer listTimer;
-static int epollfd = 0;
+const int TIMESLOT = 5;                 //定时时长，非活动连接在3个TIMESLOT后被关闭
+static TimerQueue *timerQueue = nullptr;
+static EventLoop *loop = nullptr;
+static int timerfd = -1;
+static int sigfd = -1;
+static int64_t armedExpire = -1;        //timerfd当前设定的到期时刻，-1表示未设定
+static ConnectionTable<Client> *users = nullptr;    //以描述符为下标的连接表，按需分配
+static bool stopServer = false;
+/*
+ * 惰性超时：收到数据时只记下时刻，不动定时器；定时器到期时如果连接在这期间活动过，
+ * 就以最近一次活动的时刻重新计时。每个连接每个超时周期最多调整一次定时器队列。
+ * 关闭时每次收到数据都调整定时器（急切模式）
+ */
+static bool lazyTimeout = true;
+static int32_t timerSlack = 0;          //超时定时器允许推迟的毫秒数，相近的超时合并成一次唤醒
 
 /*
-  *功能：信号处理函数，将信号发送到管道中
-  */
-void SignalHandler(int sig)
+ * 功能：屏蔽要处理的信号，并创建接收这些信号的signalfd。信号不再打断进程执行信号处理函数，
+ *       而是作为signalfd上的可读事件和其他I/O事件一起由epoll统一处理
+ */
+int CreateSignalFd()
 {
-    int oldErrno = errno;
-    int message = sig;
-    send(pipefd[1], (char *)&message, 1, 0);
-    errno = oldErrno;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    assert(sigprocmask(SIG_BLOCK, &mask, NULL) != -1);
+    int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(sigfd != -1);
+    return sigfd;
 }
 
 /*
-  * 功能：添加信号到信号集合中
-  */
- void AddSignal(int sig)
- {
-     struct sigaction sa;
-     memset(&sa, '\0', sizeof(sa));
-     sa.sa_handler = SignalHandler;
-     sa.sa_flags |= SA_RESTART;
-     sigfillset(&sa.sa_mask);       //在信号集中设置所有信号
-     assert(sigaction(sig, &sa, NULL) != -1);
- }
+ * 功能：执行一次定时器心跳，并记录它的耗时
+ */
+void RunTick()
+{
+    uint64_t start = NowNs();
+    timerQueue->Tick();
+    loop->Stats().tickNs.Record(NowNs() - start);
+}
 
- /*
-  * 定时器处理函数
-  */
- void TimerHandler()
- {
-     //定时地处理任务，其实就是调用Tick函数
-     listTimer.Tick();
-     //因为一次alarm调用只会引起一次SIGALRM信号，所以要重新定时，以不断触发SIGALRM信号
-     alarm(TIMESLOT);
- }
+/*
+ * 功能：把timerfd设定为定时器队列中最近的到期时刻，队列为空时关闭timerfd。
+ *       到期时刻没有变化时不做系统调用
+ */
+void ResetTimerFd()
+{
+    int64_t expire = timerQueue->NextExpire();
+    if (expire == armedExpire)
+    {
+        return;
+    }
+    struct itimerspec newValue;
+    memset(&newValue, 0, sizeof(newValue));
+    if (expire != -1)
+    {
+        /*使用绝对时间，0表示关闭定时器，所以至少设为1毫秒*/
+        if (expire <= 0)
+        {
+            expire = 1;
+        }
+        newValue.it_value.tv_sec = expire / 1000;
+        newValue.it_value.tv_nsec = (expire % 1000) * 1000000;
+    }
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &newValue, NULL);
+    armedExpire = expire;
+}
 
  /*
-  * 定时器回调函数，删除非活动连接socket上的注册事件，并关闭该socket
+  * 定时器回调函数，关闭非活动连接socket（关闭时内核同时把它从epoll中删除），本轮结束时释放它在连接表中的表项。
+  * 调用时定时器必须已经不在队列中（到期的定时器在回调之前就已经离开队列）
   */
 void CallBack(ClientData *userData)
 {
-    //从epoll事件中删除非活动连接socket
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, userData->clntsock, NULL);
     assert(userData);
-    close(userData->clntsock);
-    printf("close socket: %d\n", userData->clntsock);
+    int clntsock = userData->clntsock;
+    loop->Close(users->Get(clntsock));
+    printf("close socket: %d\n", clntsock);
+}
+
+void Client::OnClosed()
+{
+    data.input.Release();
+    users->Release(GetFd());
+}
+
+/*
+ * 定时器到期的回调：记录从超时时刻到回调实际执行的延迟，然后关闭连接
+ */
+void TimeoutCallBack(ClientData *userData)
+{
+    /*NowNs和定时器用的是同一个单调时钟*/
+    int64_t lagUs = (int64_t)(NowNs() / 1000) - userData->timer.expire * 1000;
+    loop->Stats().timerLagUs.Record(lagUs > 0 ? lagUs : 0);
+    /*惰性超时：连接在计时期间活动过，从最近一次活动的时刻重新计时*/
+    int64_t expire = userData->lastActive + 3 * TIMESLOT * 1000;
+    if (lazyTimeout && (expire > GetCurrentMs()))
+    {
+        timerQueue->AddTimer(&userData->timer, userData, expire, TimeoutCallBack);
+        return;
+    }
+    CallBack(userData);
+}
+
+/*
+ * 接受连接后的回调：注册事件，创建定时器相关：设置回调函数和定时时间，然后绑定定时器与用户数据，并加入定时器队列。
+ * 描述符可能属于本轮刚关闭、表项还没有释放的连接，这时直接重新使用这个表项
+ */
+void OnAccept(int clntsock, struct sockaddr_in &clntAddr, void *)
+{
+    Client *client = users->Acquire(clntsock);
+    //监听新的连接
+    loop->Add(client, clntsock, EPOLLIN | EPOLLRDHUP | EPOLLET);
+    client->peerClosed = false;
+    ClientData *user = &client->data;
+    user->input.Release();
+    user->clntAddr = clntAddr;
+    user->clntsock = clntsock;
+    int64_t curTime = GetCurrentMs();
+    user->lastActive = curTime;
+    user->timer.slack = timerSlack;
+    timerQueue->AddTimer(&user->timer, user, curTime + 3 * TIMESLOT * 1000, TimeoutCallBack);
+}
+
+/*
+ * 客户连接有数据接收：放进就绪列表，本轮事件全部分发完后再读
+ */
+void Client::HandleEvent(uint32_t events)
+{
+    if (events & (EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+    {
+        peerClosed = true;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+    {
+        GetLoop()->MarkReady(this);
+    }
+}
+
+/*
+ * 用一次readv把数据读进输入缓冲区。消息比缓冲区大时缓冲区按页增长，剩下的数据下一轮接着读，不会被截断
+ */
+bool Client::HandleReady()
+{
+    int sockfd = GetFd();
+    ClientData *user = &data;
+    ssize_t ret = user->input.ReadFrom(sockfd, RING_MAX_CAPACITY);
+    TimerNode *timer = &user->timer;
+
+    if (ret < 0)
+    {
+        /* 如果发生读错误，则关闭连接，并移除其定时器*/
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK))            //要排除是还没读完的情况
+        {
+            //回调函数只是关闭了连接，没有移除定时器，所以需要先自己移除
+            timerQueue->DeleteTimer(timer);
+            CallBack(user);
+        }
+        return false;
+    }
+    else if (ret == 0)
+    {
+        /*客户端关闭了连接，服务器端同样需要关闭连接，移除定时器*/
+        timerQueue->DeleteTimer(timer);
+        CallBack(user);
+        return false;
+    }
+
+    /*数据可能跨过缓冲区末尾，分两段打印，不依赖结尾的'\0'*/
+    struct iovec iov[2];
+    int count = user->input.Peek(iov);
+    printf("get %zd bytes of client data : ", ret);
+    for (int i = 0; i < count; i++)
+    {
+        printf("%.*s", (int)iov[i].iov_len, (const char *)iov[i].iov_base);
+    }
+    printf(" \n from %d\n", sockfd);
+    user->input.Consume(user->input.Size());
+
+    /*因为这是实现非活动连接关闭的功能，所以当有数据传来时，表明该连接是活动的，要延缓该连接的定时时间。
+     *惰性超时只记下活动时刻，等定时器到期时再重新计时；急切模式立即调整定时器在队列中的位置*/
+    int64_t curTime = GetCurrentMs();
+    user->lastActive = curTime;
+    if (!lazyTimeout && timer->pending)
+    {
+        printf("adjust timeout once\n");
+        timerQueue->AdjustTimer(timer, curTime + 3 * TIMESLOT * 1000);
+    }
+    /*读满了缓冲区，socket中可能还有数据（边缘触发不会再通知），缓冲区留给下一轮；否则这一批已经读完，
+     *释放缓冲区，空闲的连接不占缓冲区内存。对端已经关闭时要读到0才能关闭连接*/
+    if (!user->input.Filled())
+    {
+        user->input.Release();
+    }
+    return user->input.Filled() || peerClosed;
+}
+
+/*
+ * 监听socket可读：一次最多接受ACCEPT_BUDGET个连接
+ */
+void OnListenReadable(uint32_t, void *arg)
+{
+    AcceptConnections(*(int *)arg, ACCEPT_BUDGET, OnAccept, NULL);
+}
+
+/*
+ * 最近的定时器到期了，控制描述符在每轮最先处理，而不是等本轮其他I/O事件处理完
+ */
+void OnTimerReadable(uint32_t, void *)
+{
+    uint64_t expirations;
+    if (read(timerfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+    {
+        armedExpire = -1;
+        RunTick();
+    }
+}
+
+/*
+ * 有信号到来，处理信号
+ */
+void OnSignalReadable(uint32_t, void *)
+{
+    struct signalfd_siginfo siginfo;
+    //边缘触发，要把所有信号都读出来
+    while (read(sigfd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
+    {
+        switch(siginfo.ssi_signo)
+        {
+            case SIGALRM:           //外部发来的SIGALRM，立即检查一次定时器
+            {
+                RunTick();
+                break;
+            }
+            case SIGUSR1:           //打印事件循环的统计
+            {
+                loop->Stats().Print();
+                fflush(stdout);
+                break;
+            }
+            case SIGTERM:           //终止服务器
+            {
+                stopServer = true;
+            }
+        }
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    if ((argc < 3) || (argc > 7))
     {
-        printf("Usage : %s <ip> <port>\n", basename(argv[0]));
+        printf("Usage : %s <ip> <port> [list|wheel|heap] [lazy|eager] [spinUs] [slackMs]\n", basename(argv[0]));
         exit(1);
     }
     const char *ip = argv[1];
     const char *port = argv[2];
+    /*在启动时选择定时器的实现，默认是升序链表*/
+    timerQueue = CreateTimerQueue((argc >= 4) ? argv[3] : "list");
+    if (!timerQueue)
+    {
+        printf("unknown timer queue: %s\n", argv[3]);
+        exit(1);
+    }
+    /*默认惰性超时，eager表示每次收到数据都调整定时器*/
+    if (argc >= 5)
+    {
+        if (strcmp(argv[4], "eager") == 0)
+        {
+            lazyTimeout = false;
+        }
+        else if (strcmp(argv[4], "lazy") != 0)
+        {
+            printf("unknown timeout mode: %s\n", argv[4]);
+            exit(1);
+        }
+    }
+    /*忙轮询的窗口（微秒），默认0表示不忙轮询*/
+    int spinUs = (argc >= 6) ? atoi(argv[5]) : 0;
+    /*超时的合并窗口（毫秒），默认0表示每个连接准时超时。空闲连接的超时本来就不需要精确到毫秒，
+     *合并后同一批连接的超时由一次timerfd唤醒、一次Tick处理*/
+    timerSlack = (argc == 7) ? atoi(argv[6]) : 0;
     int ret = 0;
-    struct sockaddr_in servAddr, clntAddr;
+    struct sockaddr_in servAddr;
     InitSocketAddress(servAddr, ip, port);
 
-    int servsock = socket(PF_INET, SOCK_STREAM, 0);
+    int servsock = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     assert(servsock >= 0);
     ret = bind(servsock, (struct sockaddr *)&servAddr, sizeof(servAddr));
     assert(ret != -1);
-    ret = listen(servsock, 5);
-    assert(ret != -1);
-    epoll_event events[MAX_EVENT_NUMBER];
-    epollfd = epoll_create(5);
+    ret = listen(servsock, SOMAXCONN);
     assert(ret != -1);
-    addfd(epollfd, servsock);
-    //创建一对连接的socket
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-    SetNonblocking(pipefd[1]);
-    //设置读出管道的读就绪事件
-    addfd(epollfd, pipefd[0]);
-
-    /*设置信号处理函数*/
-    AddSignal(SIGALRM);
-    AddSignal(SIGTERM);
-    bool stopServer = false;
-    ClientData *users = new ClientData[FD_LIMIT];
-    bool timeout = false;
-    alarm(TIMESLOT);
-    while (!stopServer)
+    loop = new EventLoop();
+    /*忙轮询：有事件后spinUs微秒内不阻塞，接受的连接继承监听socket的内核忙轮询设置*/
+    if (spinUs > 0)
     {
-        int eventNum = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if ((eventNum < 0) && (errno != EINTR))     //如果发生的事件小于0且不是处于中断中，那就是出错了
+        loop->SetBusyPoll(spinUs);
+        if (SetBusyPoll(servsock, spinUs) == -1)
         {
-            printf("epoll failure!\n");
-            break;
+            printf("SO_BUSY_POLL unavailable, spinning in epoll_wait only\n");
         }
+    }
+    users = new ConnectionTable<Client>();
+    //监听socket、timerfd和signalfd是控制描述符，每轮先于客户数据处理，每个客户连接每轮只读一次
+    CallbackHandler listenHandler, timerHandler, signalHandler;
+    listenHandler.SetCallback(OnListenReadable, &servsock);
+    loop->Add(&listenHandler, servsock, EPOLLIN, true);
+    //定时器和信号都作为epoll的事件源：timerfd在最近的定时器到期时可读，signalfd在收到信号时可读
+    //timerfd与定时器使用同一个单调时钟，到期时刻可以直接设为绝对时间
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(timerfd != -1);
+    timerHandler.SetCallback(OnTimerReadable, NULL);
+    loop->Add(&timerHandler, timerfd, EPOLLIN | EPOLLET, true);
+    sigfd = CreateSignalFd();
+    signalHandler.SetCallback(OnSignalReadable, NULL);
+    loop->Add(&signalHandler, sigfd, EPOLLIN | EPOLLET, true);
 
-        /*遍历处理发生的事件*/
-        for (int i = 0; i < eventNum; i++)
-        {
-            int sockfd = events[i].data.fd;
-
-            /*如果是新的客户连接*/
-            if (sockfd == servsock)
-            {
-                socklen_t clntAddrSize = sizeof(clntAddr);
-                int clntsock = accept(servsock, (struct sockaddr *)&clntAddr, &clntAddrSize);
-                //监听新的连接
-                addfd(epollfd, clntsock);
-                /*创建定时器相关：设置回调函数和定时时间，然后绑定定时器与用户数据，并加入链表*/
-                users[clntsock].clntAddr = clntAddr;
-                users[clntsock].clntsock = clntsock;
-                UtilTimer *clntTimer = new UtilTimer();
-                clntTimer->userData = &users[clntsock];
-                clntTimer->callback = CallBack;
-                time_t curTime = time(NULL);
-                clntTimer->expire = curTime + 3 * TIMESLOT;
-                users[clntsock].timer = clntTimer;
-                listTimer.AddTimer(clntTimer);
-            }
-            /*如果有事件发生，则处理信号*/
-            else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
-            {
-                char signals[MAX_EVENT_NUMBER];
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1)          //因为管道读是非阻塞的
-                {
-                    continue;
-                }
-                else if (ret == 0)      
-                {
-                    continue;
-                }
-                else 
-                {
-                    //遍历处理各个信号事件
-                    for (int i = 0; i < ret; i++)
-                    {
-                        switch(signals[i])
-                        {
-                            case SIGALRM:           //定时器到
-                            {
-                                /*用timeout变量标记有定时任务需要处理，但不立即进行处理，因为定时任务的优先级不是很高，优先处理其他更重要的任务*/
-                                timeout = true;
-                                break;
-                            }
-                            case SIGTERM:           //终止服务器
-                            {
-                                stopServer = true;
-                            }
-                        }
-                    }
-                }
-            }
-            /*客户连接有数据接收*/
-            else if (events[i].events & EPOLLIN)
-            {
-                memset(users[sockfd].readBuffer, '\0', BUF_SIZE);
-                ret = recv(sockfd, users[sockfd].readBuffer, BUF_SIZE - 1, 0);
-                printf("get %d bytes of client data : %s \n from %d\n", ret, users[sockfd].readBuffer, sockfd);
-                UtilTimer *timer = users[sockfd].timer;
-
-                if (ret < 0)
-                {
-                    /* 如果发生读错误，则关闭连接，并移除其定时器*/
-                    if (errno != EAGAIN)            //要排除是还没读完的情况
-                    {
-                        CallBack(&users[sockfd]);
-                        //回调函数只是移除了事件注册和关闭连接，没有移除定时器，所以需要自己移除
-                        if (timer)
-                        {
-                            listTimer.DeleteTimer(timer);
-                        }
-                    }
-                }
-                else if (ret == 0)
-                {
-                    /*客户端关闭了连接，服务器端同样需要关闭连接，移除定时器*/
-                    CallBack(&users[sockfd]);
-                    if (timer)
-                    {
-                        listTimer.DeleteTimer(timer);
-                    }
-                }
-                else
-                {
-                    /*因为这是实现非活动连接关闭的功能，所以当有数据传来时，表明该连接是活动的，要延缓该连接的定时时间，并调整在链表的位置*/
-                    if (timer)
-                    {
-                        time_t curTime = time(NULL);
-                        timer->expire = curTime + 3 * TIMESLOT;
-                        printf("adjust timeout once\n");
-                        listTimer.AdjustTimer(timer);
-                    }
-                }
-            }
-            else
-            {
-                ;
-            }
-        }
-        /*处理完其他事件后，再来处理定时事件，会导致定时不准*/
-        if (timeout)
+    while (!stopServer)
+    {
+        if (!loop->RunOnce(-1))
         {
-            TimerHandler();
-            timeout = false;
+            printf("epoll failure!\n");
+            break;
         }
+        /*本轮事件可能增删或调整了定时器，把timerfd重新设定到最近的到期时刻*/
+        ResetTimerFd();
     }
     close(servsock);
-    close(pipefd[1]);
-    close(pipefd[0]);
-    delete[] users;
+    close(timerfd);
+    close(sigfd);
+    //定时器结点嵌入在users中，先销毁定时器队列
+    delete timerQueue;
+    delete users;
+    delete loop;
     return 0;
-}
\ No newline at end of file
+}
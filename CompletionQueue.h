@@ -0,0 +1,90 @@
+/* ************************************************************************
+> File Name:     CompletionQueue.h
+> Author:        Luncles
+> 功能：          工作线程向反应堆回传处理结果的完成队列
+> Created Time:  Sat 17 Oct 2026 10:40:31 AM CST
+> Description:   工作线程调用Push把处理完的任务放进队列，并写eventfd唤醒反应堆；反应堆把eventfd注册到
+                 epoll中，可读时调用PopAll一次性取走所有结果，再在自己的线程里完成写回、重置EPOLLONESHOT
+                 或关闭连接等操作。eventfd是计数器，多次Push只会产生一次可读事件。
+ ************************************************************************/
+
+#ifndef COMPLETION_QUEUE
+#define COMPLETION_QUEUE
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <vector>
+#include <exception>
+
+template <typename T>
+class CompletionQueue
+{
+public:
+    CompletionQueue();
+    ~CompletionQueue();
+    /*工作线程调用：放入一个完成的任务并通知反应堆*/
+    void Push(T *done);
+    /*反应堆调用：取走队列中的所有任务，返回取到的数量*/
+    int PopAll(std::vector<T *> &out);
+    /*返回用于注册到epoll的eventfd*/
+    int GetEventFd() const { return eventFd; }
+
+private:
+    int eventFd;
+    std::vector<T *> doneList;
+    pthread_mutex_t locker;
+};
+
+template <typename T>
+CompletionQueue<T>::CompletionQueue()
+{
+    /*eventfd本身设为非阻塞，反应堆读它时不会被挂起*/
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0)
+    {
+        throw std::exception();
+    }
+    pthread_mutex_init(&locker, NULL);
+}
+
+template <typename T>
+CompletionQueue<T>::~CompletionQueue()
+{
+    pthread_mutex_destroy(&locker);
+    close(eventFd);
+}
+
+template <typename T>
+void CompletionQueue<T>::Push(T *done)
+{
+    pthread_mutex_lock(&locker);
+    bool wasEmpty = doneList.empty();
+    doneList.push_back(done);
+    pthread_mutex_unlock(&locker);
+
+    /*只有队列从空变为非空时才需要唤醒反应堆，否则反应堆必然还没有取走上一次的通知*/
+    if (wasEmpty)
+    {
+        uint64_t one = 1;
+        ssize_t ret = write(eventFd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+template <typename T>
+int CompletionQueue<T>::PopAll(std::vector<T *> &out)
+{
+    uint64_t counter;
+    ssize_t ret = read(eventFd, &counter, sizeof(counter));
+    (void)ret;
+
+    out.clear();
+    pthread_mutex_lock(&locker);
+    out.swap(doneList);
+    pthread_mutex_unlock(&locker);
+    return out.size();
+}
+
+#endif
@@ -0,0 +1,163 @@
+/* ************************************************************************
+> File Name:     ConnectionTable.h
+> Author:        Luncles
+> 功能：          以描述符为下标、按块分配的连接表
+> Created Time:  Mon 19 Oct 2026 09:26:40 AM CST
+> Description:   表项按CHUNK_SIZE个一块分配，描述符的高位选块、低位选块内的表项，查找只有两次数组下标，
+                 不需要哈希。某个块中第一次有描述符出现时才分配这个块，块中的表项全部释放后归还内存
+                 （保留一个空块备用，避免在块的边界上反复分配和释放），所以常驻内存随活动连接数增长，
+                 描述符也没有编译期的上限。内核总是分配最小的可用描述符，活动的表项因此集中在前面的块中。
+ ************************************************************************/
+
+#ifndef CONNECTION_TABLE
+#define CONNECTION_TABLE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+template <typename T>
+class ConnectionTable
+{
+public:
+    ConnectionTable() : spare(nullptr), usedNum(0) { }
+    ~ConnectionTable();
+    /*返回fd对应的表项，fd没有被占用时返回nullptr*/
+    T *Get(int fd) const;
+    /*为新的fd占用表项，表项被重置为T()。fd已经被占用时直接返回原来的表项*/
+    T *Acquire(int fd);
+    /*释放fd的表项，所在的块变空时归还内存*/
+    void Release(int fd);
+    /*被占用的表项数*/
+    size_t Size() const { return usedNum; }
+    /*已分配的块数（不含备用块）*/
+    size_t ChunkCount() const;
+
+private:
+    static const int CHUNK_BITS = 10;
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;     //每块的表项数
+
+    struct Chunk
+    {
+        T entries[CHUNK_SIZE];
+        uint64_t used[CHUNK_SIZE / 64];     //表项是否被占用的位图
+        int usedNum;                        //块中被占用的表项数
+    };
+
+    bool IsUsed(const Chunk *chunk, int index) const { return (chunk->used[index / 64] >> (index % 64)) & 1; }
+
+private:
+    std::vector<Chunk *> chunks;    //块目录，以fd >> CHUNK_BITS为下标，没有分配的块为nullptr
+    Chunk *spare;                   //最近归还的空块，下次需要新块时直接复用
+    size_t usedNum;
+};
+
+template <typename T>
+ConnectionTable<T>::~ConnectionTable()
+{
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        delete chunks[i];
+    }
+    delete spare;
+}
+
+template <typename T>
+T *ConnectionTable<T>::Get(int fd) const
+{
+    size_t chunkIndex = (size_t)fd >> CHUNK_BITS;
+    if ((fd < 0) || (chunkIndex >= chunks.size()) || !chunks[chunkIndex])
+    {
+        return nullptr;
+    }
+    Chunk *chunk = chunks[chunkIndex];
+    int index = fd & (CHUNK_SIZE - 1);
+    return IsUsed(chunk, index) ? &chunk->entries[index] : nullptr;
+}
+
+template <typename T>
+T *ConnectionTable<T>::Acquire(int fd)
+{
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    size_t chunkIndex = (size_t)fd >> CHUNK_BITS;
+    if (chunkIndex >= chunks.size())
+    {
+        chunks.resize(chunkIndex + 1, nullptr);
+    }
+    Chunk *chunk = chunks[chunkIndex];
+    if (!chunk)
+    {
+        if (spare)
+        {
+            chunk = spare;
+            spare = nullptr;
+        }
+        else
+        {
+            chunk = new Chunk();
+        }
+        chunks[chunkIndex] = chunk;
+    }
+
+    int index = fd & (CHUNK_SIZE - 1);
+    if (!IsUsed(chunk, index))
+    {
+        chunk->entries[index] = T();
+        chunk->used[index / 64] |= (uint64_t)1 << (index % 64);
+        chunk->usedNum++;
+        usedNum++;
+    }
+    return &chunk->entries[index];
+}
+
+template <typename T>
+void ConnectionTable<T>::Release(int fd)
+{
+    size_t chunkIndex = (size_t)fd >> CHUNK_BITS;
+    if ((fd < 0) || (chunkIndex >= chunks.size()) || !chunks[chunkIndex])
+    {
+        return;
+    }
+    Chunk *chunk = chunks[chunkIndex];
+    int index = fd & (CHUNK_SIZE - 1);
+    if (!IsUsed(chunk, index))
+    {
+        return;
+    }
+    chunk->used[index / 64] &= ~((uint64_t)1 << (index % 64));
+    chunk->usedNum--;
+    usedNum--;
+
+    /*块空了就从目录中摘下：留作备用块，已经有备用块时释放*/
+    if (chunk->usedNum == 0)
+    {
+        chunks[chunkIndex] = nullptr;
+        if (spare)
+        {
+            delete chunk;
+        }
+        else
+        {
+            spare = chunk;
+        }
+    }
+}
+
+template <typename T>
+size_t ConnectionTable<T>::ChunkCount() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (chunks[i])
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,760 @@
+/* ************************************************************************
+> File Name:     EchoBench.cpp
+> Author:        Luncles
+> 功能：          回声服务器的压测客户端：TCP/UDP吞吐与延迟、建连速率和空闲连接
+> Created Time:  Tue 20 Oct 2026 10:05:33 AM CST
+> Description:   每个线程一个epoll，负责一部分连接（或UDP流），所有连接都是非阻塞的。
+                 tcp模式：每个连接保持depth个请求在途（流水线），回声按顺序返回，按字节数切分出每条消息；
+                 指定rate时按固定间隔发出请求（开环），延迟从计划发送的时刻算起，排队时间也计入延迟。
+                 udp模式：每个流是一个connect过的UDP socket，报文头部带有发送时刻，丢失的报文在超时后不再等待。
+                 idle模式：只建立连接不发数据，记录每个连接被服务器关闭前存活的时间，用来检验CloseNonaliveSocket。
+                 connect模式：每个连接发1字节、收到回声后立即关闭并重新连接，统计建连速率。
+                 halfclose模式：每个连接边发边读，发完msgSize字节（可以超过64KB）后shutdown(SHUT_WR)，一直读到服务器
+                 关闭连接，检查收到的回声是否完整。接收缓冲区设得很小，回声的速度跟不上请求，服务器的socket发送缓冲区
+                 （回环上最大4MB）满了之后回声积压在它的输出缓冲区中，msgSize比它大得多时，服务器读到EOF时输出缓冲区中
+                 几乎总有数据，用来检验服务器不会在读到EOF时丢掉还没发完的数据。
+                 编译：g++ -std=c++11 -O2 -o EchoBench EchoBench.cpp init_socket.cpp -lpthread
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <deque>
+#include <vector>
+#include "init_socket.h"
+#include "Histogram.h"
+
+#define MAX_EVENT_NUMBER 1024
+#define IO_BUFFER_SIZE 65536
+#define MAX_PENDING_CONNECTS 512        //每个线程同时进行中的connect数，避免一次性把服务器的积压队列打满
+#define UDP_LOSS_TIMEOUT_NS 500000000ULL //UDP流这么久没有收到回声，就认为在途的报文都丢了
+#define HALFCLOSE_RCVBUF 4096           //halfclose模式的接收缓冲区，让回声积压在服务器上
+
+enum BenchMode { MODE_TCP, MODE_UDP, MODE_IDLE, MODE_CONNECT, MODE_HALFCLOSE };
+
+/*压测参数，所有线程共享，只读*/
+struct BenchConfig
+{
+    BenchMode mode;
+    struct sockaddr_in servAddr;
+    int conns;              //TCP连接数或UDP流数
+    int idleConns;          //tcp/udp模式下额外保持的空闲连接数
+    int msgSize;            //每条消息的字节数
+    int depth;              //每个连接的在途消息数
+    double rate;            //所有线程合计每秒发出的消息数，0表示闭环（收到回声就发下一条）
+    double secs;            //测量时长（秒），从所有连接建立完成时开始
+    int threads;            //线程数
+    int srcAddrs;           //回环测试时轮流绑定的源地址数（127.0.0.1 ~ 127.0.0.N），突破单个源地址的端口数限制
+};
+
+/*一个连接或UDP流的状态*/
+struct Conn
+{
+    int fd;
+    int index;              //在本线程中的编号，用于选择源地址
+    bool connected;
+    bool idle;              //只保持连接，不发数据
+    bool writeShut;         //halfclose模式：已经发完并关闭了写
+    uint32_t events;        //当前在epoll中注册的事件
+    uint64_t startNs;       //开始connect或建立连接的时刻
+    uint64_t lastActiveNs;  //UDP流最后一次收发的时刻
+    int inflight;           //在途的消息数
+    uint64_t sendLeft;      //已经排队但还没有写出的字节数
+    uint64_t recvInMsg;     //当前消息已经收到的字节数
+    std::deque<uint64_t> stamps;    //在途消息的计划发送时刻，回声按顺序返回
+};
+
+/*每个线程的统计，结束后在主线程合并*/
+struct BenchStats
+{
+    Histogram latencyUs;        //请求到回声的延迟（微秒）
+    Histogram connectUs;        //建立连接的耗时（微秒）
+    Histogram idleLifeMs;       //空闲连接被服务器关闭前存活的时间（毫秒）
+    uint64_t msgs;              //测量期间完成的消息数
+    uint64_t connects;          //成功建立的连接数
+    uint64_t connectFailed;     //建立失败的连接数
+    uint64_t closedByPeer;      //被服务器关闭的连接数
+    uint64_t lost;              //UDP丢失的报文数
+    uint64_t truncated;         //halfclose模式：没有收到完整回声就被关闭的连接数
+    double connectSecs;         //本线程建立全部连接所用的时间
+    double measureSecs;         //本线程实际的测量时长
+
+    BenchStats() : msgs(0), connects(0), connectFailed(0), closedByPeer(0), lost(0), truncated(0), connectSecs(0), measureSecs(0) { }
+};
+
+struct BenchThread
+{
+    pthread_t tid;
+    int id;
+    const BenchConfig *config;
+    int epollfd;
+    int connNum;                    //本线程负责的连接数
+    int idleNum;                    //本线程负责的空闲连接数
+    std::vector<Conn> conns;
+    int nextConnect;                //下一个要建立的连接
+    int pendingConnects;            //进行中的connect数
+    int established;                //已经建立（或失败）的连接数
+    std::deque<uint64_t> backlog;   //开环模式下所有连接都满了时，等待发出的消息的计划时刻
+    size_t rrNext;                  //开环模式下轮流选择连接的位置
+    bool measuring;                 //是否已经进入测量阶段
+    BenchStats stats;
+};
+
+static char sendBuffer[IO_BUFFER_SIZE];
+
+/*
+ * 功能：修改连接在epoll中关注的事件，没有变化时不做系统调用
+ */
+void UpdateEvents(BenchThread *thread, Conn *conn, uint32_t events)
+{
+    if (conn->events == events)
+    {
+        return;
+    }
+    epoll_event event;
+    event.data.ptr = conn;
+    event.events = events;
+    epoll_ctl(thread->epollfd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->events = events;
+}
+
+/*
+ * 功能：关闭连接，connect模式下随后会重新建立
+ */
+void CloseConn(BenchThread *thread, Conn *conn)
+{
+    epoll_ctl(thread->epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    conn->connected = false;
+    conn->inflight = 0;
+    conn->sendLeft = 0;
+    conn->recvInMsg = 0;
+    conn->writeShut = false;
+    conn->stamps.clear();
+}
+
+/*
+ * 功能：发起一个非阻塞的connect，TCP连接在可写时完成；UDP流connect后立即可用
+ */
+bool StartConnect(BenchThread *thread, Conn *conn)
+{
+    const BenchConfig *config = thread->config;
+    bool udp = (config->mode == MODE_UDP) && !conn->idle;
+    conn->fd = socket(PF_INET, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0)
+    {
+        return false;
+    }
+    if (!udp)
+    {
+        /*小消息流水线发送时不让Nagle算法把延迟推迟到对端的延迟确认*/
+        int on = 1;
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (config->mode == MODE_HALFCLOSE)
+    {
+        /*在connect之前设置，握手时通告的窗口就是小的*/
+        int rcvbuf = HALFCLOSE_RCVBUF;
+        setsockopt(conn->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    if (config->srcAddrs > 1)
+    {
+        /*只绑定地址不分配端口，端口在connect时按四元组分配*/
+        int on = 1;
+        setsockopt(conn->fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + (uint32_t)((thread->id + conn->index) % config->srcAddrs));
+        bind(conn->fd, (struct sockaddr *)&local, sizeof(local));
+    }
+    conn->startNs = NowNs();
+    int ret = connect(conn->fd, (const struct sockaddr *)&config->servAddr, sizeof(config->servAddr));
+    if ((ret < 0) && (errno != EINPROGRESS))
+    {
+        close(conn->fd);
+        conn->fd = -1;
+        return false;
+    }
+    epoll_event event;
+    event.data.ptr = conn;
+    event.events = udp ? EPOLLIN : (EPOLLOUT | EPOLLIN | EPOLLRDHUP);
+    epoll_ctl(thread->epollfd, EPOLL_CTL_ADD, conn->fd, &event);
+    conn->events = event.events;
+    conn->lastActiveNs = conn->startNs;
+    if (udp)
+    {
+        conn->connected = true;
+    }
+    return true;
+}
+
+/*
+ * 功能：把排队的字节尽量写出去。TCP连接写不完时关注EPOLLOUT
+ */
+bool FlushTcp(BenchThread *thread, Conn *conn)
+{
+    while (conn->sendLeft > 0)
+    {
+        size_t len = (conn->sendLeft < IO_BUFFER_SIZE) ? conn->sendLeft : IO_BUFFER_SIZE;
+        ssize_t ret = send(conn->fd, sendBuffer, len, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        conn->sendLeft -= ret;
+    }
+    /*halfclose模式：全部写出后关闭写，服务器读到EOF时它的输出缓冲区中往往还有回声*/
+    if ((thread->config->mode == MODE_HALFCLOSE) && (conn->sendLeft == 0) && !conn->writeShut)
+    {
+        shutdown(conn->fd, SHUT_WR);
+        conn->writeShut = true;
+    }
+    UpdateEvents(thread, conn, EPOLLIN | EPOLLRDHUP | ((conn->sendLeft > 0) ? (uint32_t)EPOLLOUT : 0u));
+    return true;
+}
+
+/*
+ * 功能：在连接上发出一条计划在stampNs发送的消息。UDP报文的头部带上这个时刻，回声回来时直接算延迟
+ */
+bool IssueMessage(BenchThread *thread, Conn *conn, uint64_t stampNs)
+{
+    const BenchConfig *config = thread->config;
+    conn->inflight++;
+    conn->lastActiveNs = NowNs();
+    if (config->mode == MODE_UDP)
+    {
+        char datagram[IO_BUFFER_SIZE];
+        memset(datagram, 'u', config->msgSize);
+        memcpy(datagram, &stampNs, sizeof(stampNs));
+        if (send(conn->fd, datagram, config->msgSize, 0) < 0)
+        {
+            //发送缓冲区满时当作丢失
+            conn->inflight--;
+            thread->stats.lost++;
+        }
+        return true;
+    }
+    conn->stamps.push_back(stampNs);
+    conn->sendLeft += config->msgSize;
+    return FlushTcp(thread, conn);
+}
+
+/*
+ * 功能：一条消息完成，记录延迟
+ */
+void CompleteMessage(BenchThread *thread, Conn *conn, uint64_t stampNs, uint64_t now)
+{
+    conn->inflight--;
+    thread->stats.latencyUs.Record((now > stampNs) ? (now - stampNs) / 1000 : 0);
+    if (thread->measuring)
+    {
+        thread->stats.msgs++;
+    }
+}
+
+/*
+ * 功能：开环模式下把积压的消息分给有空位的连接；闭环模式下把连接的在途消息补满
+ */
+void FillConn(BenchThread *thread, Conn *conn)
+{
+    const BenchConfig *config = thread->config;
+    if (!conn->connected || conn->idle || (config->mode == MODE_IDLE) || (config->mode == MODE_CONNECT) ||
+        (config->mode == MODE_HALFCLOSE))
+    {
+        return;
+    }
+    while (conn->inflight < config->depth)
+    {
+        uint64_t stamp;
+        if (config->rate > 0)
+        {
+            if (thread->backlog.empty())
+            {
+                break;
+            }
+            stamp = thread->backlog.front();
+            thread->backlog.pop_front();
+        }
+        else
+        {
+            stamp = NowNs();
+        }
+        if (!IssueMessage(thread, conn, stamp))
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * 功能：连接建立（或失败）后的处理
+ */
+void OnConnected(BenchThread *thread, Conn *conn, bool ok)
+{
+    const BenchConfig *config = thread->config;
+    thread->pendingConnects--;
+    if (!ok)
+    {
+        thread->stats.connectFailed++;
+        CloseConn(thread, conn);
+        thread->established++;
+        return;
+    }
+    conn->connected = true;
+    thread->stats.connects++;
+    thread->stats.connectUs.Record((NowNs() - conn->startNs) / 1000);
+    if (!thread->measuring || (config->mode != MODE_CONNECT))
+    {
+        thread->established++;
+    }
+    conn->startNs = NowNs();
+    if (conn->idle || (config->mode == MODE_IDLE))
+    {
+        UpdateEvents(thread, conn, EPOLLIN | EPOLLRDHUP);
+    }
+    else if (config->mode == MODE_CONNECT)
+    {
+        conn->stamps.push_back(NowNs());
+        conn->inflight = 1;
+        conn->sendLeft = 1;
+        FlushTcp(thread, conn);
+    }
+    else if (config->mode == MODE_HALFCLOSE)
+    {
+        conn->sendLeft = config->msgSize;
+        FlushTcp(thread, conn);
+    }
+    else
+    {
+        UpdateEvents(thread, conn, EPOLLIN | EPOLLRDHUP);
+        FillConn(thread, conn);
+    }
+}
+
+/*
+ * 功能：处理可读事件。TCP回声按顺序返回，按字节数切分出完成的消息；UDP从报文头部取出发送时刻
+ */
+void HandleRead(BenchThread *thread, Conn *conn)
+{
+    const BenchConfig *config = thread->config;
+    char buf[IO_BUFFER_SIZE];
+    while (conn->fd >= 0)
+    {
+        ssize_t ret = recv(conn->fd, buf, sizeof(buf), 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            {
+                thread->stats.closedByPeer++;
+                CloseConn(thread, conn);
+            }
+            return;
+        }
+        uint64_t now = NowNs();
+        if (ret == 0)
+        {
+            /*服务器关闭了连接：空闲连接记录存活时间*/
+            if (conn->idle || (config->mode == MODE_IDLE))
+            {
+                thread->stats.idleLifeMs.Record((now - conn->startNs) / 1000000);
+            }
+            /*halfclose：服务器要把回声全部发完才关闭连接*/
+            if (config->mode == MODE_HALFCLOSE)
+            {
+                if (conn->recvInMsg == (uint64_t)config->msgSize)
+                {
+                    thread->stats.msgs++;
+                    thread->stats.latencyUs.Record((now - conn->startNs) / 1000);
+                }
+                else
+                {
+                    thread->stats.truncated++;
+                }
+            }
+            thread->stats.closedByPeer++;
+            CloseConn(thread, conn);
+            return;
+        }
+        conn->lastActiveNs = now;
+        if (config->mode == MODE_UDP)
+        {
+            uint64_t stamp;
+            memcpy(&stamp, buf, sizeof(stamp));
+            if (conn->inflight > 0)
+            {
+                CompleteMessage(thread, conn, stamp, now);
+            }
+            continue;
+        }
+        conn->recvInMsg += ret;
+        uint64_t msgSize = (config->mode == MODE_CONNECT) ? 1 : config->msgSize;
+        while ((conn->recvInMsg >= msgSize) && !conn->stamps.empty())
+        {
+            conn->recvInMsg -= msgSize;
+            CompleteMessage(thread, conn, conn->stamps.front(), now);
+            conn->stamps.pop_front();
+        }
+        if (config->mode == MODE_CONNECT)
+        {
+            /*收到回声后关闭，再建立下一个连接*/
+            CloseConn(thread, conn);
+            return;
+        }
+    }
+}
+
+/*
+ * 功能：UDP流长时间没有回声时，认为在途的报文都已丢失，腾出窗口
+ */
+void ExpireLostDatagrams(BenchThread *thread, uint64_t now)
+{
+    for (size_t i = 0; i < thread->conns.size(); i++)
+    {
+        Conn *conn = &thread->conns[i];
+        if (conn->connected && !conn->idle && (conn->inflight > 0) && (now - conn->lastActiveNs > UDP_LOSS_TIMEOUT_NS))
+        {
+            thread->stats.lost += conn->inflight;
+            conn->inflight = 0;
+            conn->lastActiveNs = now;
+            FillConn(thread, conn);
+        }
+    }
+}
+
+/*
+ * 压测线程：先建立本线程的全部连接，然后在secs秒内收发并统计
+ */
+void *BenchMain(void *arg)
+{
+    BenchThread *thread = (BenchThread *)arg;
+    const BenchConfig *config = thread->config;
+    thread->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    int total = thread->connNum + thread->idleNum;
+    thread->conns.resize(total);
+    for (int i = 0; i < total; i++)
+    {
+        Conn *conn = &thread->conns[i];
+        conn->fd = -1;
+        conn->index = i;
+        conn->connected = false;
+        conn->idle = (i >= thread->connNum);
+        conn->writeShut = false;
+        conn->inflight = 0;
+        conn->sendLeft = 0;
+        conn->recvInMsg = 0;
+    }
+
+    /*开环模式下本线程每隔intervalNs发出一条消息*/
+    double threadRate = config->rate / config->threads;
+    uint64_t intervalNs = (threadRate > 0) ? (uint64_t)(1e9 / threadRate) : 0;
+    uint64_t nextSendNs = 0;
+
+    uint64_t begin = NowNs();
+    uint64_t measureStart = 0, deadline = 0;
+    uint64_t lastLossCheck = begin;
+    epoll_event events[MAX_EVENT_NUMBER];
+    while (1)
+    {
+        uint64_t now = NowNs();
+        /*所有连接都建立后开始计时*/
+        if (!thread->measuring && (thread->established >= total))
+        {
+            thread->measuring = true;
+            thread->stats.connectSecs = (now - begin) / 1e9;
+            measureStart = now;
+            deadline = now + (uint64_t)(config->secs * 1e9);
+            nextSendNs = now;
+        }
+        if (thread->measuring && (now >= deadline))
+        {
+            break;
+        }
+        /*idle和halfclose模式下所有连接都被服务器关闭后提前结束*/
+        if (thread->measuring && ((config->mode == MODE_IDLE) || (config->mode == MODE_HALFCLOSE)) && (thread->stats.closedByPeer >= (uint64_t)thread->stats.connects))
+        {
+            break;
+        }
+
+        /*发起新的connect：首次建立全部连接；connect模式下测量期间不断重连*/
+        while ((thread->pendingConnects < MAX_PENDING_CONNECTS) && (thread->nextConnect < total))
+        {
+            Conn *conn = &thread->conns[thread->nextConnect++];
+            if (StartConnect(thread, conn))
+            {
+                if (conn->connected)      //UDP流
+                {
+                    thread->pendingConnects++;
+                    OnConnected(thread, conn, true);
+                }
+                else
+                {
+                    thread->pendingConnects++;
+                }
+            }
+            else
+            {
+                thread->stats.connectFailed++;
+                thread->established++;
+            }
+        }
+        if (thread->measuring && (config->mode == MODE_CONNECT))
+        {
+            for (int i = 0; (i < total) && (thread->pendingConnects < MAX_PENDING_CONNECTS); i++)
+            {
+                Conn *conn = &thread->conns[i];
+                if ((conn->fd < 0) && StartConnect(thread, conn))
+                {
+                    thread->pendingConnects++;
+                }
+            }
+        }
+
+        /*开环模式：把到期的计划消息交给有空位的连接*/
+        if (thread->measuring && (intervalNs > 0))
+        {
+            while (nextSendNs <= now)
+            {
+                thread->backlog.push_back(nextSendNs);
+                nextSendNs += intervalNs;
+            }
+            for (size_t k = 0; (k < thread->conns.size()) && !thread->backlog.empty(); k++)
+            {
+                Conn *conn = &thread->conns[thread->rrNext];
+                thread->rrNext = (thread->rrNext + 1) % thread->conns.size();
+                FillConn(thread, conn);
+            }
+        }
+        if ((config->mode == MODE_UDP) && (now - lastLossCheck > UDP_LOSS_TIMEOUT_NS / 5))
+        {
+            ExpireLostDatagrams(thread, now);
+            lastLossCheck = now;
+        }
+
+        int timeout = 10;
+        if (thread->measuring && (intervalNs > 0))
+        {
+            timeout = (nextSendNs > now) ? (int)((nextSendNs - now) / 1000000) : 0;
+        }
+        int eventNum = epoll_wait(thread->epollfd, events, MAX_EVENT_NUMBER, timeout);
+        for (int i = 0; i < eventNum; i++)
+        {
+            Conn *conn = (Conn *)events[i].data.ptr;
+            if (conn->fd < 0)
+            {
+                continue;
+            }
+            if (!conn->connected)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if ((err != 0) || (events[i].events & (EPOLLERR | EPOLLHUP)))
+                {
+                    OnConnected(thread, conn, false);
+                }
+                else if (events[i].events & EPOLLOUT)
+                {
+                    OnConnected(thread, conn, true);
+                }
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+            {
+                HandleRead(thread, conn);
+            }
+            if ((conn->fd >= 0) && (events[i].events & EPOLLOUT))
+            {
+                if (!FlushTcp(thread, conn))
+                {
+                    thread->stats.closedByPeer++;
+                    CloseConn(thread, conn);
+                    continue;
+                }
+            }
+            if (conn->fd >= 0)
+            {
+                FillConn(thread, conn);
+            }
+        }
+    }
+    thread->stats.measureSecs = (NowNs() - measureStart) / 1e9;
+    for (size_t i = 0; i < thread->conns.size(); i++)
+    {
+        if (thread->conns[i].fd >= 0)
+        {
+            close(thread->conns[i].fd);
+        }
+    }
+    close(thread->epollfd);
+    return NULL;
+}
+
+void Usage(const char *name)
+{
+    printf("Usage : %s <ip> <port> <tcp|udp|idle|connect|halfclose> [-c conns] [-i idleConns] [-s msgSize] [-d depth]\n"
+           "        [-r rate] [-t secs] [-T threads] [-a srcAddrs]\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        Usage(argv[0]);
+    }
+    BenchConfig config;
+    InitSocketAddress(config.servAddr, argv[1], argv[2]);
+    if (strcmp(argv[3], "tcp") == 0)
+    {
+        config.mode = MODE_TCP;
+    }
+    else if (strcmp(argv[3], "udp") == 0)
+    {
+        config.mode = MODE_UDP;
+    }
+    else if (strcmp(argv[3], "idle") == 0)
+    {
+        config.mode = MODE_IDLE;
+    }
+    else if (strcmp(argv[3], "connect") == 0)
+    {
+        config.mode = MODE_CONNECT;
+    }
+    else if (strcmp(argv[3], "halfclose") == 0)
+    {
+        config.mode = MODE_HALFCLOSE;
+    }
+    else
+    {
+        Usage(argv[0]);
+    }
+    config.conns = 1;
+    config.idleConns = 0;
+    config.msgSize = 64;
+    config.depth = 1;
+    config.rate = 0;
+    config.secs = 5;
+    config.threads = 1;
+    config.srcAddrs = 1;
+
+    int opt;
+    optind = 4;
+    while ((opt = getopt(argc, argv, "c:i:s:d:r:t:T:a:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': config.conns = atoi(optarg); break;
+            case 'i': config.idleConns = atoi(optarg); break;
+            case 's': config.msgSize = atoi(optarg); break;
+            case 'd': config.depth = atoi(optarg); break;
+            case 'r': config.rate = atof(optarg); break;
+            case 't': config.secs = atof(optarg); break;
+            case 'T': config.threads = atoi(optarg); break;
+            case 'a': config.srcAddrs = atoi(optarg); break;
+            default: Usage(argv[0]);
+        }
+    }
+    if ((config.conns <= 0) || (config.depth <= 0) || (config.threads <= 0) || (config.msgSize <= 0) ||
+        ((config.msgSize > IO_BUFFER_SIZE) && (config.mode != MODE_HALFCLOSE)) || ((config.mode == MODE_UDP) && (config.msgSize < (int)sizeof(uint64_t))))
+    {
+        Usage(argv[0]);
+    }
+    memset(sendBuffer, 'x', sizeof(sendBuffer));
+
+    /*连接平均分给各个线程*/
+    BenchThread *threads = new BenchThread[config.threads];
+    for (int i = 0; i < config.threads; i++)
+    {
+        threads[i].id = i;
+        threads[i].config = &config;
+        threads[i].connNum = config.conns / config.threads + ((i < config.conns % config.threads) ? 1 : 0);
+        threads[i].idleNum = config.idleConns / config.threads + ((i < config.idleConns % config.threads) ? 1 : 0);
+        threads[i].nextConnect = 0;
+        threads[i].pendingConnects = 0;
+        threads[i].established = 0;
+        threads[i].rrNext = 0;
+        threads[i].measuring = false;
+        pthread_create(&threads[i].tid, NULL, BenchMain, &threads[i]);
+    }
+
+    BenchStats total;
+    double connectSecs = 0, measureSecs = 0;
+    for (int i = 0; i < config.threads; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        BenchStats &stats = threads[i].stats;
+        total.latencyUs.Merge(stats.latencyUs);
+        total.connectUs.Merge(stats.connectUs);
+        total.idleLifeMs.Merge(stats.idleLifeMs);
+        total.msgs += stats.msgs;
+        total.connects += stats.connects;
+        total.connectFailed += stats.connectFailed;
+        total.closedByPeer += stats.closedByPeer;
+        total.lost += stats.lost;
+        total.truncated += stats.truncated;
+        connectSecs = (stats.connectSecs > connectSecs) ? stats.connectSecs : connectSecs;
+        measureSecs = (stats.measureSecs > measureSecs) ? stats.measureSecs : measureSecs;
+    }
+
+    printf("mode=%s conns=%d idle=%d size=%d depth=%d rate=%.0f threads=%d\n", argv[3], config.conns,
+        config.idleConns, config.msgSize, config.depth, config.rate, config.threads);
+    int initial = config.conns + config.idleConns;
+    printf("connect      %d connections in %.3fs (%.0f conns/s), %llu failed\n", initial, connectSecs,
+        (connectSecs > 0) ? initial / connectSecs : 0.0, (unsigned long long)total.connectFailed);
+    total.connectUs.Print("connect", "us");
+    if ((config.mode == MODE_TCP) || (config.mode == MODE_UDP) || (config.mode == MODE_CONNECT))
+    {
+        double perSec = (measureSecs > 0) ? total.msgs / measureSecs : 0;
+        printf("throughput   %.0f msgs/s, %.1f MB/s echoed over %.2fs\n", perSec,
+            (config.mode == MODE_CONNECT) ? 0.0 : perSec * config.msgSize / 1e6, measureSecs);
+        if (config.mode == MODE_CONNECT)
+        {
+            printf("reconnect    %.0f connect+echo+close cycles/s\n", perSec);
+        }
+        total.latencyUs.Print("latency", "us");
+        if (config.mode == MODE_UDP)
+        {
+            printf("lost         %llu datagrams\n", (unsigned long long)total.lost);
+        }
+    }
+    if (config.mode == MODE_HALFCLOSE)
+    {
+        printf("halfclose    %llu of %d connections got the full %d-byte echo before EOF, %llu truncated\n",
+            (unsigned long long)total.msgs, config.conns, config.msgSize, (unsigned long long)total.truncated);
+        total.latencyUs.Print("echo time", "us");
+    }
+    else if ((config.mode == MODE_IDLE) || (config.idleConns > 0))
+    {
+        printf("idle         %llu connections closed by server\n", (unsigned long long)total.idleLifeMs.Count());
+        total.idleLifeMs.Print("idle life", "ms");
+    }
+    else if (total.closedByPeer > 0)
+    {
+        printf("closed       %llu connections closed by server\n", (unsigned long long)total.closedByPeer);
+    }
+    delete[] threads;
+    return 0;
+}
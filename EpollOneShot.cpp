@@ -12,86 +12,243 @@
 #include <unistd.h>
 #include <assert.h>
 
-#define MAX_EVENT_NUMBER 1024
-#define BUF_SIZE 1024
+#include <vector>
+#include "ThreadPool.h"
+#include "CompletionQueue.h"
+#include "init_socket.h"
+#include "EventLoop.h"
+#include "RingBuffer.h"
 
-struct fds
-{
-    int epollfd;
-    int sockfd;    /* data */
-};
+#define FD_LIMIT 65535
+#define MAX_REQUEST_NUMBER 10000
 
-/*将描述符设置为非阻塞*/
-int SetNonBlocking(int fd)
+/*
+ * 每个连接对应一个任务对象，按描述符下标存放，它同时是这个连接在事件循环中的处理器。因为注册了EPOLLONESHOT，
+ * 同一个连接在任意时刻最多只有一个任务在线程池中，所以任务对象可以复用，不需要每次事件都重新分配
+ */
+struct EpollTask : public EventHandler
 {
-    int oldOption = fcntl(fd, F_GETFL);
-    int newOption = oldOption | O_NONBLOCK;
-    fcntl(fd, F_SETFL, newOption);
-    return oldOption;
-}
+    /*工作线程处理完后给反应堆的指示*/
+    enum Action { REARM, CLOSE };
 
-/*将fd上的EPOLLIN和EPOLLET事件注册到epollfd指示的epoll内核事件表中，参数oneshot指定是否注册fd上的EPOLLONESHOT事件*/
-void addfd(int epollfd, int fd, bool oneshot)
-{
-    epoll_event event;
-    event.data.fd = fd;
-    event.events = EPOLLIN | EPOLLET;
-    if (oneshot)
-    {
-        event.events |= EPOLLONESHOT;
-    }
-    //在epoll例程描述符epollfd中注册描述符fd，用于监视事件C
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    SetNonBlocking(fd);
-}
+    int sockfd;
+    RingBuffer input;                       //工作线程的输入缓冲区，在工作线程中申请和释放，空闲的连接不占缓冲区内存
+    std::vector<char> unsent;               //工作线程没有写完、交给反应堆等可写时再写的回声
+    size_t unsentHead;                      //unsent中第一个未发送字节的下标
+    Action action;
+    CompletionQueue<EpollTask> *doneQueue;  //处理结果交回反应堆的完成队列
+    ThreadPool<EpollTask> *pool;            //处理可读事件的线程池
 
-/*重置fd上的事件，这样尽管fd上的EPOLLONESHOT事件被注册，但操作系统仍会触发fd上的EPOLLIN事件，且只触发一次*/
-void ResetOneShot(int epollfd, int fd)
-{
-    epoll_event event;
-    event.data.fd = fd;
-    event.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
-    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
-}
+    EpollTask() : sockfd(-1), unsentHead(0), action(REARM), doneQueue(nullptr), pool(nullptr) { }
+
+    /*反应堆调用：连接可读，把任务交给线程池，队列满时在这里等待，形成背压；还有没写回的数据时是可写事件，接着写*/
+    virtual void HandleEvent(uint32_t events);
+    /*工作线程调用：读取sockfd上的数据并写回，然后把结果放入完成队列*/
+    void Process();
+    /*等待反应堆写回的字节数*/
+    size_t UnsentBytes() const { return unsent.size() - unsentHead; }
+
+private:
+    /*工作线程调用：把输入缓冲区中的数据写回，写不完的部分复制到unsent。返回false表示连接出错*/
+    bool EchoInput();
+};
 
-/*工作线程*/
-void *EpollWorkerMain(void *arg)
+/*EPOLLONESHOT：事件触发一次后描述符被禁用，任务完成后由反应堆重新启用*/
+const uint32_t TASK_EVENTS = EPOLLIN | EPOLLET | EPOLLONESHOT;
+/*回声没有写完时只等可写，写完之前不再读，一个不读回声的客户端不会让服务器无限缓存它的数据*/
+const uint32_t WRITE_EVENTS = EPOLLOUT | EPOLLET | EPOLLONESHOT;
+
+/*
+ * 工作线程：用readv把sockfd上的数据读进输入缓冲区，缓冲区按需增长，readv没有读满就说明已经读完，
+ * 不必再读一次等EAGAIN；缓冲区增长到最大仍然读满时也停下。处理（这里是回声）和写回在工作线程中进行，
+ * 输入缓冲区也在这里释放，回到本线程的缓冲区池；对端接收慢、没写完的部分交给反应堆等可写时再写。
+ * 重置EPOLLONESHOT和关闭连接都交回反应堆完成，避免工作线程关闭的描述符被新连接复用后，反应堆再对它进行操作
+ */
+void EpollTask::Process()
 {
-    int sockfd = ((fds *)arg)->sockfd;
-    int epollfd = ((fds *)arg)->epollfd;
-    printf("start new thread to receive data on fd:%d\n", sockfd);
-    char buf[BUF_SIZE];
-    memset(buf, '\0', BUF_SIZE);
-
-    /*循环读取sockfd上的数据，因为是非阻塞的，所以当遇到EAGAIN错误时表示还不能读*/
-    while (1)
+    action = REARM;
+    while (true)
     {
-        int ret = recv(sockfd, buf, BUF_SIZE - 1, 0);
-        
+        ssize_t ret = input.ReadFrom(sockfd, RING_MAX_CAPACITY);
+
         /*收到0表示断开连接*/
         if (ret == 0)
         {
-            close(sockfd);
-            printf("closed the connection\n");
+            action = CLOSE;
             break;
         }
         else if (ret < 0)
         {
-            if (errno == EAGAIN)    //暂时还不能读
+            //暂时还不能读（或者缓冲区已满），交回反应堆重置EPOLLONESHOT
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS))
+            {
+                action = CLOSE;
+            }
+            break;
+        }
+        else if (!input.Filled())
+        {
+            break;
+        }
+    }
+    if (!EchoInput())
+    {
+        action = CLOSE;
+    }
+    /*缓冲区池是线程局部的，输入缓冲区必须在申请它的工作线程中释放*/
+    input.Release();
+    /*重置EPOLLONESHOT时内核会检查描述符的状态，剩余的数据和读完数据后才到达的关闭都会再次通知*/
+    doneQueue->Push(this);
+}
+
+/*
+ * 工作线程把输入缓冲区中的数据写回，对端接收缓冲区满时停下，剩下的数据复制到unsent。
+ * 只有慢客户端才会走到复制这一步，这时瓶颈在对端，多一次复制不影响吞吐
+ */
+bool EpollTask::EchoInput()
+{
+    while (input.Size() > 0)
+    {
+        struct iovec iov[2];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = input.Peek(iov);
+        ssize_t ret = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
             {
-                ResetOneShot(epollfd, sockfd);
-                printf("read later\n");
                 break;
             }
+            return false;
         }
-        else
+        input.Consume(ret);
+    }
+    struct iovec iov[2];
+    int count = (input.Size() > 0) ? input.Peek(iov) : 0;
+    for (int i = 0; i < count; i++)
+    {
+        unsent.insert(unsent.end(), (char *)iov[i].iov_base, (char *)iov[i].iov_base + iov[i].iov_len);
+    }
+    return true;
+}
+
+/*
+ * 反应堆把工作线程没写完的回声写回，对端接收缓冲区满时停下。返回false表示连接出错
+ */
+bool FlushUnsent(EpollTask *task)
+{
+    while (task->UnsentBytes() > 0)
+    {
+        ssize_t ret = send(task->sockfd, &task->unsent[task->unsentHead], task->UnsentBytes(), MSG_NOSIGNAL);
+        if (ret < 0)
         {
-            printf("get content:%s\n", buf);
-            /*休眠5秒，模拟数据处理过程*/
-            sleep(5);
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (errno == EAGAIN) || (errno == EWOULDBLOCK);
         }
+        task->unsentHead += ret;
+    }
+    return true;
+}
+
+/*
+ * 反应堆处理工作线程交回的结果（或者回声没写完的连接可写了）：先写回工作线程没写完的数据，写不完时只关注可写，
+ * 全部写完后再根据指示重置EPOLLONESHOT或关闭连接，对端已经关闭写时也要先把回声写完。
+ * 重置在本轮结束时和其他任务的重置一起提交
+ */
+void CompleteTask(EventLoop *loop, EpollTask *task)
+{
+    if (!FlushUnsent(task))
+    {
+        task->action = EpollTask::CLOSE;
+    }
+    else if (task->UnsentBytes() > 0)
+    {
+        loop->Modify(task, WRITE_EVENTS);
+        return;
+    }
+    /*写完后释放内存，空闲的连接不占内存*/
+    std::vector<char>().swap(task->unsent);
+    task->unsentHead = 0;
+    if (task->action == EpollTask::CLOSE)
+    {
+        loop->Close(task);
+        printf("closed the connection on fd:%d\n", task->sockfd);
+    }
+    else
+    {
+        loop->Modify(task, TASK_EVENTS);
+    }
+}
+
+void EpollTask::HandleEvent(uint32_t)
+{
+    /*ONESHOT保证工作线程处理期间不会有事件，还有没写回的数据说明这是等待写回时的可写（或出错）事件*/
+    if (UnsentBytes() > 0)
+    {
+        CompleteTask(GetLoop(), this);
+        return;
+    }
+    pool->Append(this);
+}
+
+/*反应堆需要的状态*/
+struct ReactorContext
+{
+    EventLoop *loop;
+    int servSock;
+    EpollTask *tasks;
+    CompletionQueue<EpollTask> *doneQueue;
+    ThreadPool<EpollTask> *pool;
+    std::vector<EpollTask *> doneTasks;
+};
+
+/*
+ * 接受连接后的回调：对每个非监听连接的文件描述符都注册EPOLLONESHOT事件
+ */
+void OnAccept(int clntSock, struct sockaddr_in &, void *arg)
+{
+    ReactorContext *context = (ReactorContext *)arg;
+    if (clntSock >= FD_LIMIT)
+    {
+        close(clntSock);
+        return;
+    }
+    EpollTask *task = &context->tasks[clntSock];
+    task->sockfd = clntSock;
+    task->doneQueue = context->doneQueue;
+    task->pool = context->pool;
+    context->loop->Add(task, clntSock, TASK_EVENTS);
+}
+
+/*
+ * 监听socket可读：一次最多接受ACCEPT_BUDGET个连接，监听socket是水平触发的，剩下的下一轮还会被通知
+ */
+void OnListenReadable(uint32_t, void *arg)
+{
+    ReactorContext *context = (ReactorContext *)arg;
+    AcceptConnections(context->servSock, ACCEPT_BUDGET, OnAccept, context);
+}
+
+/*
+ * 完成队列的eventfd可读：工作线程交回了处理结果
+ */
+void OnDoneReadable(uint32_t, void *arg)
+{
+    ReactorContext *context = (ReactorContext *)arg;
+    context->doneQueue->PopAll(context->doneTasks);
+    for (size_t i = 0; i < context->doneTasks.size(); i++)
+    {
+        CompleteTask(context->loop, context->doneTasks[i]);
     }
-    printf("end thread receiving data on fd:%d\n", sockfd);
 }
 
 int main(int argc, char *argv[])
@@ -101,11 +258,10 @@ int main(int argc, char *argv[])
         printf("Usage: %s <ip><port>\n", basename(argv[0]));
         exit(1);
     }
-    int servSock, clntSock;
-    struct sockaddr_in servAddr, clntAddr;
-    socklen_t clntAddrSize;
+    int servSock;
+    struct sockaddr_in servAddr;
 
-    servSock = socket(PF_INET, SOCK_STREAM, 0);
+    servSock = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     assert(servSock >= 0);
 
     memset(&servAddr, 0, sizeof(servAddr));
@@ -115,51 +271,40 @@ int main(int argc, char *argv[])
 
     int ret = bind(servSock, (struct sockaddr *)&servAddr, sizeof(servAddr));
     assert(ret != -1);
-    ret = listen(servSock, 5);
+    ret = listen(servSock, SOMAXCONN);
     assert(ret != -1);
 
-    epoll_event events[MAX_EVENT_NUMBER];
-    int epollfd = epoll_create(5);
-    assert(epollfd != -1);
+    EventLoop loop;
 
-    /*监听socket servSock上是不能注册EPOLLONESHOT事件的，否则应用程序只能处理一个客户连接，因为后续的客户连接请求将不再触发servSock上的EPOLLIN事件*/
-    addfd(epollfd, servSock, false);
-    while (1)
+    /*线程数等于CPU核数，不再为每个可读事件创建线程*/
+    int threadNum = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threadNum <= 0)
     {
-        int ret = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if (ret < 0)
-        {
-            printf("epoll failure\n");
-            break;
-        }
-        for (int i = 0; i < ret; i++)
-        {
-            int sockfd = events[i].data.fd;
-            if (sockfd == servSock)
-            {
-                clntAddrSize = sizeof(clntAddr);
-                clntSock = accept(servSock, (struct sockaddr *)&clntAddr, &clntAddrSize);
+        threadNum = 1;
+    }
+    ThreadPool<EpollTask> pool(threadNum, MAX_REQUEST_NUMBER);
+    CompletionQueue<EpollTask> doneQueue;
+    EpollTask *tasks = new EpollTask[FD_LIMIT];
+    ReactorContext context;
+    context.loop = &loop;
+    context.servSock = servSock;
+    context.tasks = tasks;
+    context.doneQueue = &doneQueue;
+    context.pool = &pool;
 
-                /*对每个非监听连接的文件描述符都注册EPOLLONESHOT事件*/
-                addfd(epollfd, clntSock, true);
-            }
-            else if (events[i].events & EPOLLIN)    /*如果是读取数据事件*/
-            {
-                /*新开一个工作线程为sockfd服务*/
-                pthread_t pid;
-                fds newWorkerFds;
-                newWorkerFds.epollfd = epollfd;
-                newWorkerFds.sockfd = sockfd;
+    /*监听socket servSock上是不能注册EPOLLONESHOT事件的，否则应用程序只能处理一个客户连接，因为后续的客户连接请求将不再触发servSock上的EPOLLIN事件。
+      它以水平触发注册，一轮没有接受完的连接下一轮还会被通知*/
+    CallbackHandler listenHandler;
+    listenHandler.SetCallback(OnListenReadable, &context);
+    loop.Add(&listenHandler, servSock, EPOLLIN, true);
 
-                pthread_create(&pid, NULL, EpollWorkerMain, (void *)&newWorkerFds);
-            }
-            else
-            {
-                printf("something else happened\n");
-            }
-        }
-    }
+    /*完成队列的eventfd同样注册到事件循环中，工作线程交回结果时唤醒反应堆*/
+    CallbackHandler doneHandler;
+    doneHandler.SetCallback(OnDoneReadable, &context);
+    loop.Add(&doneHandler, doneQueue.GetEventFd(), EPOLLIN | EPOLLET, true);
+
+    loop.Run();
     close(servSock);
+    delete[] tasks;
     return 0;
 }
-
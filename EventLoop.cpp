@@ -0,0 +1,286 @@
+/* ************************************************************************
+> File Name:     EventLoop.cpp
+> Author:        Luncles
+> 功能：          三个服务器共用的epoll事件循环的实现
+> Created Time:  Sat 24 Oct 2026 10:05:41 AM CST
+> Description:
+ ************************************************************************/
+
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <algorithm>
+#include "EventLoop.h"
+#include "Clock.h"
+
+EventLoop::EventLoop() : quit(false), round(0), spinMaxNs(0), spinNs(0), lastActiveNs(0), emptyPolls(0), readySeq(0)
+{
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(epollfd != -1);
+}
+
+EventLoop::~EventLoop()
+{
+    close(epollfd);
+}
+
+void EventLoop::Add(EventHandler *handler, int fd, uint32_t events, bool control)
+{
+    if ((size_t)fd >= handlers.size())
+    {
+        handlers.resize(fd + 1, nullptr);
+    }
+    handlers[fd] = handler;
+    handler->loop = this;
+    handler->fd = fd;
+    handler->interest = events;
+    handler->registered = 0;
+    handler->addedRound = round;
+    handler->active = true;
+    handler->added = false;
+    handler->ready = false;
+    handler->control = control;
+    handler->closing = false;
+    if (!handler->dirty)
+    {
+        handler->dirty = true;
+        dirtyList.push_back(handler);
+    }
+}
+
+void EventLoop::Modify(EventHandler *handler, uint32_t events)
+{
+    /*与上一次修改相同时什么也不做：要么已经提交，要么已经在修改列表中*/
+    if (!handler->active || ((events == handler->interest) && !(events & EPOLLONESHOT)))
+    {
+        return;
+    }
+    handler->interest = events;
+    if (!handler->dirty)
+    {
+        handler->dirty = true;
+        dirtyList.push_back(handler);
+    }
+}
+
+void EventLoop::Detach(EventHandler *handler)
+{
+    handler->active = false;
+    if (handlers[handler->fd] == handler)
+    {
+        handlers[handler->fd] = nullptr;
+    }
+    /*就绪列表中的项不在这里移出（大量连接同时关闭时每次都要扫描整个列表），只让它失效，处理就绪列表时跳过*/
+    handler->ready = false;
+}
+
+void EventLoop::Remove(EventHandler *handler)
+{
+    if (!handler->active)
+    {
+        return;
+    }
+    if (handler->added)
+    {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, handler->fd, NULL);
+    }
+    Detach(handler);
+}
+
+void EventLoop::Close(EventHandler *handler)
+{
+    if (!handler->active)
+    {
+        return;
+    }
+    Detach(handler);
+    close(handler->fd);
+    if (!handler->closing)
+    {
+        handler->closing = true;
+        closedList.push_back(handler);
+    }
+}
+
+void EventLoop::MarkReady(EventHandler *handler)
+{
+    if (handler->active && !handler->ready)
+    {
+        handler->ready = true;
+        handler->readySeq = ++readySeq;
+        ReadyEntry entry = { handler->fd, handler->readySeq };
+        readyList.push_back(entry);
+    }
+}
+
+EventHandler *EventLoop::GetHandler(int fd) const
+{
+    return ((fd >= 0) && ((size_t)fd < handlers.size())) ? handlers[fd] : nullptr;
+}
+
+void EventLoop::ApplyChanges()
+{
+    for (size_t i = 0; i < dirtyList.size(); i++)
+    {
+        EventHandler *handler = dirtyList[i];
+        handler->dirty = false;
+        if (!handler->active)
+        {
+            continue;
+        }
+        struct epoll_event event;
+        event.data.ptr = handler;
+        event.events = handler->interest;
+        if (!handler->added)
+        {
+            epoll_ctl(epollfd, EPOLL_CTL_ADD, handler->fd, &event);
+            handler->added = true;
+        }
+        else if ((handler->interest != handler->registered) || (handler->interest & EPOLLONESHOT))
+        {
+            epoll_ctl(epollfd, EPOLL_CTL_MOD, handler->fd, &event);
+        }
+        handler->registered = handler->interest;
+    }
+    dirtyList.clear();
+}
+
+void EventLoop::ServeReadyList()
+{
+    readyServing.swap(readyList);
+    uint64_t handlerStart = NowNs();
+    for (size_t i = 0; i < readyServing.size(); i++)
+    {
+        EventHandler *handler = GetHandler(readyServing[i].fd);
+        if (!handler || !handler->ready || (handler->readySeq != readyServing[i].seq))
+        {
+            continue;
+        }
+        handler->ready = false;
+        if (handler->HandleReady())
+        {
+            MarkReady(handler);
+        }
+        uint64_t handlerEnd = NowNs();
+        stats.handlerNs.Record(handlerEnd - handlerStart);
+        handlerStart = handlerEnd;
+    }
+    readyServing.clear();
+    if (!readyList.empty())
+    {
+        stats.deferred.Record(readyList.size());
+    }
+}
+
+void EventLoop::FinishClosed()
+{
+    for (size_t i = 0; i < closedList.size(); i++)
+    {
+        EventHandler *handler = closedList[i];
+        /*本轮中又被Add的处理器已经重新使用，不能再释放*/
+        if (handler->closing)
+        {
+            handler->closing = false;
+            handler->OnClosed();
+        }
+    }
+    closedList.clear();
+}
+
+void EventLoop::SetBusyPoll(int spinUs)
+{
+    spinMaxNs = (spinUs > 0) ? (uint64_t)spinUs * 1000 : 0;
+    spinNs = spinMaxNs;
+    lastActiveNs = NowNs();
+}
+
+void EventLoop::AdaptSpin(uint64_t nowNs, bool blocked)
+{
+    if (blocked)
+    {
+        uint64_t idleNs = nowNs - lastActiveNs;
+        if (idleNs <= spinMaxNs)
+        {
+            spinNs = std::min(spinMaxNs, std::max(spinNs * 2, (uint64_t)SPIN_MIN_NS));
+        }
+        else
+        {
+            spinNs /= 2;
+        }
+    }
+    /*记录这次有事件之前空转了多少次，忙轮询窗口从现在重新开始*/
+    stats.spinPolls.Record(emptyPolls);
+    emptyPolls = 0;
+    lastActiveNs = nowNs;
+}
+
+bool EventLoop::RunOnce(int timeoutMs)
+{
+    round++;
+    ApplyChanges();
+    int timeout = readyList.empty() ? timeoutMs : 0;
+    /*忙轮询：最近有过事件时不阻塞，窗口过去后仍然没有事件就退回阻塞等待*/
+    bool spinning = false;
+    if ((spinMaxNs > 0) && (timeout != 0) && (NowNs() - lastActiveNs < spinNs))
+    {
+        timeout = 0;
+        spinning = true;
+    }
+    int eventNum = epoll_wait(epollfd, events, LOOP_MAX_EVENTS, timeout);
+    if (eventNum < 0)
+    {
+        return errno == EINTR;
+    }
+    /*本轮所有的定时器操作都使用这一次读到的时间*/
+    UpdateLoopClock();
+    /*上一个事件处理结束的时刻就是下一个事件开始的时刻*/
+    uint64_t handlerStart = NowNs();
+    if (eventNum > 0)
+    {
+        stats.batchSize.Record(eventNum);
+        if (spinMaxNs > 0)
+        {
+            AdaptSpin(handlerStart, !spinning && (timeout != 0));
+        }
+    }
+    else if (spinning)
+    {
+        emptyPolls++;
+    }
+
+    /*分两遍：先分发控制描述符的事件，再分发其他事件*/
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool control = (pass == 0);
+        for (int i = 0; i < eventNum; i++)
+        {
+            EventHandler *handler = (EventHandler *)events[i].data.ptr;
+            if ((handler->control != control) || !handler->active || (handler->addedRound == round))
+            {
+                continue;
+            }
+            handler->HandleEvent(events[i].events);
+            uint64_t handlerEnd = NowNs();
+            stats.handlerNs.Record(handlerEnd - handlerStart);
+            handlerStart = handlerEnd;
+        }
+    }
+    ServeReadyList();
+    /*先提交修改，再释放关闭的处理器，修改列表中不会留下已经释放的处理器*/
+    ApplyChanges();
+    FinishClosed();
+    return true;
+}
+
+void EventLoop::Run()
+{
+    while (!quit)
+    {
+        if (!RunOnce(-1))
+        {
+            printf("epoll failure\n");
+            break;
+        }
+    }
+}
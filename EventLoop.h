@@ -0,0 +1,153 @@
+/* ************************************************************************
+> File Name:     EventLoop.h
+> Author:        Luncles
+> 功能：          三个服务器共用的epoll事件循环：处理器对象、按描述符索引的处理器表和批量提交的关注事件
+> Created Time:  Sat 24 Oct 2026 10:05:41 AM CST
+> Description:   每个注册的描述符由一个EventHandler对象负责，epoll_event.data.ptr直接指向它，
+                 分发事件就是调用它的HandleEvent，不需要把描述符和监听socket、UDP socket等逐个比较。
+                 Add和Modify只记下希望关注的事件，每轮在等待事件之前一次性提交，一轮中多次修改只提交最后一次，
+                 与已注册的相同时不做系统调用。
+                 每轮的顺序：提交修改 -> epoll_wait -> 先分发控制描述符（监听socket、signalfd、timerfd等）
+                 的事件，再分发其他事件 -> 处理就绪列表 -> 提交本轮的修改 -> 调用本轮关闭的处理器的OnClosed。
+                 就绪列表用于公平地分配工作：处理器在HandleEvent中调用MarkReady，本轮事件全部分发完后
+                 才调用它的HandleReady，每次只做一份预算内的工作，没做完的留到下一轮，此时epoll_wait不阻塞。
+                 Close关闭描述符后处理器要到本轮结束才调用OnClosed，本轮后面指向它的事件都会被丢弃，
+                 处理器可以在OnClosed中释放自己，分发事件时不会访问已经释放的处理器。
+                 可选的忙轮询：最近一次有事件之后的一段时间（窗口）内epoll_wait不阻塞，新的事件到来时线程还在运行，
+                 省去一次唤醒的延迟；窗口内一直没有事件就退回阻塞等待，空闲时不占CPU。
+                 窗口是自适应的（与内核cpuidle-haltpoll的做法相同）：阻塞等待后来的事件离上一次事件不超过
+                 SetBusyPoll给出的上限时，说明更长的窗口本可以接住它，窗口翻倍；超过上限时空转是白费的，窗口减半。
+                 请求间隔比上限长的负载因此很快就不再空转。
+                 事件循环不是线程安全的，每个线程一个。
+ ************************************************************************/
+
+#ifndef EVENT_LOOP
+#define EVENT_LOOP
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <vector>
+#include "Histogram.h"
+
+#define LOOP_MAX_EVENTS 1024        //每次epoll_wait最多返回的事件数
+#define SPIN_MIN_NS 10000           //忙轮询窗口从0增长时的起点（纳秒）
+
+class EventLoop;
+
+/*
+ * 事件处理器：负责一个描述符上的事件，由事件循环的使用者派生
+ */
+class EventHandler
+{
+public:
+    EventHandler() : loop(nullptr), fd(-1), interest(0), registered(0), addedRound(0), readySeq(0), active(false),
+        added(false), dirty(false), ready(false), control(false), closing(false) { }
+    virtual ~EventHandler() { }
+    /*描述符上发生了events中的事件（EPOLLIN、EPOLLOUT等）*/
+    virtual void HandleEvent(uint32_t events) = 0;
+    /*调用MarkReady后，本轮事件全部分发完时调用。返回true表示工作还没有做完（例如读满了预算），下一轮再调用*/
+    virtual bool HandleReady() { return false; }
+    /*调用Close后，本轮事件处理完时调用，之后不会再有指向它的事件，可以在这里释放处理器*/
+    virtual void OnClosed() { }
+    int GetFd() const { return fd; }
+    EventLoop *GetLoop() const { return loop; }
+
+private:
+    friend class EventLoop;
+    EventLoop *loop;
+    int fd;
+    uint32_t interest;      //希望关注的事件
+    uint32_t registered;    //已经提交给epoll的事件
+    uint64_t addedRound;    //在第几轮被Add，同一轮中epoll返回的事件不可能属于它
+    uint64_t readySeq;      //就绪列表中属于它的那一项的序号，其他项都已经失效
+    bool active;            //是否注册在事件循环中
+    bool added;             //是否已经EPOLL_CTL_ADD
+    bool dirty;             //是否在待提交的修改列表中
+    bool ready;             //是否在就绪列表中
+    bool control;           //是否是控制描述符，每轮最先分发
+    bool closing;           //是否在等待OnClosed
+};
+
+/*
+ * 用函数处理事件的处理器，用于监听socket、signalfd、timerfd这类每个程序只有一两个的描述符
+ */
+class CallbackHandler : public EventHandler
+{
+public:
+    typedef void (*Callback)(uint32_t events, void *arg);
+
+    CallbackHandler() : callback(nullptr), arg(nullptr) { }
+    void SetCallback(Callback callback, void *arg) { this->callback = callback; this->arg = arg; }
+    virtual void HandleEvent(uint32_t events) { callback(events, arg); }
+
+private:
+    Callback callback;
+    void *arg;
+};
+
+class EventLoop
+{
+public:
+    EventLoop();
+    ~EventLoop();
+    /*让handler负责fd上的events，control为true时它的事件每轮最先分发。描述符必须已经是非阻塞的*/
+    void Add(EventHandler *handler, int fd, uint32_t events, bool control = false);
+    /*修改关注的事件。带EPOLLONESHOT时即使事件不变也会重新提交，以重新启用描述符*/
+    void Modify(EventHandler *handler, uint32_t events);
+    /*把描述符从epoll中删除，描述符保持打开*/
+    void Remove(EventHandler *handler);
+    /*关闭描述符（内核同时把它从epoll中删除），本轮结束时调用handler->OnClosed。
+     *本轮结束之前handler又被Add时不再调用OnClosed，描述符被复用的表项可以直接重新使用*/
+    void Close(EventHandler *handler);
+    /*本轮事件分发完后调用handler->HandleReady*/
+    void MarkReady(EventHandler *handler);
+    /*fd对应的处理器，没有时返回nullptr*/
+    EventHandler *GetHandler(int fd) const;
+    /*打开忙轮询，窗口最长spinUs微秒。0（默认）表示关闭*/
+    void SetBusyPoll(int spinUs);
+    /*执行一轮事件循环，timeoutMs为-1时一直等到有事件（就绪列表非空或者在忙轮询的窗口内时不等待）。epoll出错时返回false*/
+    bool RunOnce(int timeoutMs);
+    /*一直执行，直到调用Quit或者epoll出错*/
+    void Run();
+    void Quit() { quit = true; }
+    /*事件循环的统计，只由本线程写入*/
+    LoopStats &Stats() { return stats; }
+
+private:
+    /*提交修改列表中的关注事件*/
+    void ApplyChanges();
+    /*每个就绪的处理器做一份工作，没做完的留到下一轮*/
+    void ServeReadyList();
+    /*调用本轮关闭的处理器的OnClosed*/
+    void FinishClosed();
+    /*把处理器从表和就绪列表中摘下，不再分发它的事件*/
+    void Detach(EventHandler *handler);
+    /*有事件到来时调整忙轮询的窗口，nowNs是现在，blocked表示这次epoll_wait是阻塞的*/
+    void AdaptSpin(uint64_t nowNs, bool blocked);
+
+private:
+    /*就绪列表的一项：处理器关闭后描述符可能被新的连接复用，描述符对应的处理器不在就绪状态或者序号不一致时这一项已经失效*/
+    struct ReadyEntry
+    {
+        int fd;
+        uint64_t seq;
+    };
+
+    int epollfd;
+    bool quit;
+    uint64_t round;                             //当前是第几轮
+    uint64_t spinMaxNs;                         //忙轮询窗口的上限（纳秒），0表示不忙轮询
+    uint64_t spinNs;                            //当前的忙轮询窗口（纳秒）
+    uint64_t lastActiveNs;                      //最近一次epoll_wait返回事件的时刻
+    uint64_t emptyPolls;                        //忙轮询中连续没有事件的epoll_wait次数
+    uint64_t readySeq;                          //最近一次MarkReady分配的序号
+    std::vector<EventHandler *> handlers;       //以描述符为下标的处理器表
+    std::vector<EventHandler *> dirtyList;      //关注事件有修改、等待提交的处理器
+    std::vector<ReadyEntry> readyList;          //等待HandleReady的描述符，每轮各处理一次，失效的项在处理时跳过
+    std::vector<ReadyEntry> readyServing;       //本轮正在处理的就绪列表，与readyList交换使用，避免每轮分配
+    std::vector<EventHandler *> closedList;     //本轮关闭、等待OnClosed的处理器
+    struct epoll_event events[LOOP_MAX_EVENTS];
+    LoopStats stats;
+};
+
+#endif
@@ -0,0 +1,209 @@
+/* ************************************************************************
+> File Name:     Histogram.h
+> Author:        Luncles
+> 功能：          HDR风格的对数线性直方图，用于统计事件循环的批大小、处理耗时和定时器延迟
+> Created Time:  Mon 19 Oct 2026 04:12:09 PM CST
+> Description:   把数值按2的幂分段，每段再线性地分成SUB_BUCKETS个桶，相对误差不超过1/SUB_BUCKETS，
+                 一个直方图覆盖整个uint64_t范围只需要976个计数器。每个线程只写自己的直方图：计数器是
+                 原子变量，但写者只有一个，用relaxed的load加store代替加锁或原子加法；其他线程在需要时
+                 用relaxed的load读出来合并，读到的是一个近似的快照，对统计分位数已经足够。
+ ************************************************************************/
+
+#ifndef HISTOGRAM
+#define HISTOGRAM
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+
+/*
+ * 以纳秒为单位的单调时钟，用于测量耗时
+ */
+inline uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+class Histogram
+{
+public:
+    Histogram() { Reset(); }
+    /*记录一个数值，只能由拥有这个直方图的线程调用*/
+    void Record(uint64_t value);
+    /*把other的计数加到本直方图中，other可以正在被它的线程写入*/
+    void Merge(const Histogram &other);
+    /*清空所有计数*/
+    void Reset();
+    /*记录的数值个数*/
+    uint64_t Count() const;
+    /*不小于p（0~100）百分比数值的最小值，返回所在桶的上界，没有数据时返回0*/
+    uint64_t Percentile(double p) const;
+    /*打印一行：个数、p50、p99、p999和最大值*/
+    void Print(const char *name, const char *unit) const;
+
+private:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;                       //每个2的幂分段中的线性桶数
+    static const int BUCKET_NUM = (64 - SUB_BITS + 1) * SUB_BUCKETS;    //覆盖整个uint64_t范围的桶数
+
+    /*数值所在的桶：小于SUB_BUCKETS的数值各占一个桶，更大的数值按最高位分段，再取最高位之后的SUB_BITS位*/
+    static int BucketIndex(uint64_t value);
+    /*桶中的最大数值*/
+    static uint64_t BucketUpperBound(int index);
+
+private:
+    std::atomic<uint64_t> counts[BUCKET_NUM];
+    std::atomic<uint64_t> maxValue;
+};
+
+inline int Histogram::BucketIndex(uint64_t value)
+{
+    if (value < (uint64_t)SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    return (msb - SUB_BITS + 1) * SUB_BUCKETS + (int)((value >> (msb - SUB_BITS)) - SUB_BUCKETS);
+}
+
+inline uint64_t Histogram::BucketUpperBound(int index)
+{
+    if (index < SUB_BUCKETS)
+    {
+        return index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lower + (((uint64_t)1 << shift) - 1);
+}
+
+inline void Histogram::Record(uint64_t value)
+{
+    std::atomic<uint64_t> &count = counts[BucketIndex(value)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (value > maxValue.load(std::memory_order_relaxed))
+    {
+        maxValue.store(value, std::memory_order_relaxed);
+    }
+}
+
+inline void Histogram::Merge(const Histogram &other)
+{
+    for (int i = 0; i < BUCKET_NUM; i++)
+    {
+        uint64_t add = other.counts[i].load(std::memory_order_relaxed);
+        if (add)
+        {
+            counts[i].store(counts[i].load(std::memory_order_relaxed) + add, std::memory_order_relaxed);
+        }
+    }
+    uint64_t otherMax = other.maxValue.load(std::memory_order_relaxed);
+    if (otherMax > maxValue.load(std::memory_order_relaxed))
+    {
+        maxValue.store(otherMax, std::memory_order_relaxed);
+    }
+}
+
+inline void Histogram::Reset()
+{
+    for (int i = 0; i < BUCKET_NUM; i++)
+    {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+    maxValue.store(0, std::memory_order_relaxed);
+}
+
+inline uint64_t Histogram::Count() const
+{
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKET_NUM; i++)
+    {
+        total += counts[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+inline uint64_t Histogram::Percentile(double p) const
+{
+    uint64_t total = Count();
+    if (total == 0)
+    {
+        return 0;
+    }
+    /*第rank个数值所在的桶，rank从1开始*/
+    uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_NUM; i++)
+    {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t bound = BucketUpperBound(i);
+            uint64_t max = maxValue.load(std::memory_order_relaxed);
+            return (bound < max) ? bound : max;
+        }
+    }
+    return maxValue.load(std::memory_order_relaxed);
+}
+
+inline void Histogram::Print(const char *name, const char *unit) const
+{
+    printf("%-12s count=%-10llu p50=%llu%s p99=%llu%s p999=%llu%s max=%llu%s\n", name,
+        (unsigned long long)Count(),
+        (unsigned long long)Percentile(50), unit,
+        (unsigned long long)Percentile(99), unit,
+        (unsigned long long)Percentile(99.9), unit,
+        (unsigned long long)maxValue.load(std::memory_order_relaxed), unit);
+}
+
+/*
+ * 一个事件循环线程的全部统计：每个线程一份，由该线程写入，需要时在任意线程合并后打印
+ */
+struct LoopStats
+{
+    Histogram batchSize;    //每次epoll_wait返回的事件数
+    Histogram handlerNs;    //处理单个事件的耗时（纳秒）
+    Histogram timerLagUs;   //定时器超时时刻到回调实际执行的延迟（微秒）
+    Histogram tickNs;       //每次Tick的耗时（纳秒）
+    Histogram deferred;     //读满预算、留到下一轮继续读的连接数（只记录不为0的轮次）
+    Histogram spinPolls;    //忙轮询时每次有事件之前空转（没有事件）的epoll_wait次数
+
+    void Merge(const LoopStats &other)
+    {
+        batchSize.Merge(other.batchSize);
+        handlerNs.Merge(other.handlerNs);
+        timerLagUs.Merge(other.timerLagUs);
+        tickNs.Merge(other.tickNs);
+        deferred.Merge(other.deferred);
+        spinPolls.Merge(other.spinPolls);
+    }
+
+    /*没有定时器的事件循环不打印定时器的两项*/
+    void Print() const
+    {
+        batchSize.Print("batch size", "");
+        handlerNs.Print("handler", "ns");
+        if (tickNs.Count() > 0)
+        {
+            timerLagUs.Print("timer lag", "us");
+            tickNs.Print("tick", "ns");
+        }
+        if (deferred.Count() > 0)
+        {
+            deferred.Print("deferred", "");
+        }
+        if (spinPolls.Count() > 0)
+        {
+            spinPolls.Print("spin polls", "");
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,231 @@
+/* ************************************************************************
+> File Name:     IoUring.cpp
+> Author:        Luncles
+> 功能：          io_uring封装的实现
+> Created Time:  Thu 22 Oct 2026 10:52:08 AM CST
+> Description:
+ ************************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "IoUring.h"
+
+IoUring::IoUring() : ringFd(-1), sqHead(nullptr), sqTail(nullptr), sqMask(0), sqArray(nullptr), sqes(nullptr),
+    sqeTail(0), cqHead(nullptr), cqTail(nullptr), cqMask(0), cqes(nullptr), sqRing(MAP_FAILED), sqRingSize(0),
+    cqRing(MAP_FAILED), cqRingSize(0), sqesSize(0), setupFlags(0), enterCount(0)
+{
+}
+
+IoUring::~IoUring()
+{
+    if (sqes)
+    {
+        munmap(sqes, sqesSize);
+    }
+    if ((cqRing != MAP_FAILED) && (cqRing != sqRing))
+    {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED)
+    {
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringFd >= 0)
+    {
+        close(ringFd);
+    }
+}
+
+bool IoUring::Init(unsigned entries, unsigned flags)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    /*完成队列是提交队列的4倍：多次触发的请求（multishot）一个SQE会产生很多完成事件*/
+    params.flags = flags | IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFd < 0)
+    {
+        return false;
+    }
+    setupFlags = flags;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    /*新内核上提交队列和完成队列在同一次mmap中*/
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap && (cqRingSize > sqRingSize))
+    {
+        sqRingSize = cqRingSize;
+    }
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+    {
+        return false;
+    }
+    if (singleMmap)
+    {
+        cqRing = sqRing;
+    }
+    else
+    {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqeMem = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqeMem == MAP_FAILED)
+    {
+        return false;
+    }
+    sqes = (struct io_uring_sqe *)sqeMem;
+
+    char *sq = (char *)sqRing;
+    sqHead = (unsigned *)(sq + params.sq_off.head);
+    sqTail = (unsigned *)(sq + params.sq_off.tail);
+    sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + params.sq_off.array);
+    /*SQE数组的下标与提交队列的下标一一对应*/
+    for (unsigned i = 0; i <= sqMask; i++)
+    {
+        sqArray[i] = i;
+    }
+    sqeTail = *sqTail;
+
+    char *cq = (char *)cqRing;
+    cqHead = (unsigned *)(cq + params.cq_off.head);
+    cqTail = (unsigned *)(cq + params.cq_off.tail);
+    cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+struct io_uring_sqe *IoUring::GetSqe()
+{
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqeTail - head > sqMask)
+    {
+        /*提交队列满了：先把已经准备好的SQE交给内核*/
+        SubmitAndWait(0);
+        head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (sqeTail - head > sqMask)
+        {
+            return nullptr;
+        }
+    }
+    struct io_uring_sqe *sqe = &sqes[sqeTail & sqMask];
+    sqeTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::SubmitAndWait(unsigned waitNr)
+{
+    /*把新的SQE发布给内核：先写好SQE，再以release语义移动队尾*/
+    __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if ((toSubmit == 0) && (waitNr == 0))
+    {
+        return 0;
+    }
+    unsigned flags = (waitNr > 0) ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    do
+    {
+        enterCount++;
+        ret = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, waitNr, flags, NULL, 0);
+    } while ((ret < 0) && (errno == EINTR) && (waitNr == 0));
+    return ret;
+}
+
+struct io_uring_cqe *IoUring::PeekCqe()
+{
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+    {
+        return nullptr;
+    }
+    return &cqes[head & cqMask];
+}
+
+void IoUring::SeenCqe()
+{
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+BufferRing::BufferRing() : ring(nullptr), base(nullptr), count(0), bufferSize(0), groupId(0), tail(0), ringBytes(0)
+{
+}
+
+BufferRing::~BufferRing()
+{
+    if (ring)
+    {
+        munmap(ring, ringBytes);
+    }
+    if (base)
+    {
+        munmap(base, (size_t)count * bufferSize);
+    }
+}
+
+bool BufferRing::Init(IoUring &uring, uint16_t groupId, unsigned count, unsigned size)
+{
+    this->count = count;
+    this->bufferSize = size;
+    this->groupId = groupId;
+    /*环必须按页对齐，用mmap分配*/
+    ringBytes = count * sizeof(struct io_uring_buf);
+    void *mem = mmap(NULL, ringBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return false;
+    }
+    ring = (struct io_uring_buf_ring *)mem;
+    mem = mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return false;
+    }
+    base = (char *)mem;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = count;
+    reg.bgid = groupId;
+    if (syscall(__NR_io_uring_register, uring.GetFd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        return false;
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        Recycle((uint16_t)i);
+    }
+    Commit();
+    return true;
+}
+
+/*
+ * 环就是io_uring_buf数组，队尾与第0项的保留字段重叠。不用ring->bufs：旧内核头文件中的柔性数组在C++下
+ * 前面多了一个空结构体，偏移量是8而不是0
+ */
+void BufferRing::Recycle(uint16_t bufferId)
+{
+    struct io_uring_buf *buf = (struct io_uring_buf *)ring + (tail & (count - 1));
+    buf->addr = (uint64_t)(uintptr_t)Buffer(bufferId);
+    buf->len = bufferSize;
+    buf->bid = bufferId;
+    tail++;
+}
+
+void BufferRing::Commit()
+{
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
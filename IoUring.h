@@ -0,0 +1,92 @@
+/* ************************************************************************
+> File Name:     IoUring.h
+> Author:        Luncles
+> 功能：          不依赖liburing的io_uring封装：提交队列、完成队列和提供缓冲区环
+> Created Time:  Thu 22 Oct 2026 10:17:25 AM CST
+> Description:   直接用io_uring_setup/io_uring_enter/io_uring_register三个系统调用建立环，mmap出提交队列、
+                 完成队列和SQE数组。只支持单线程使用：一个环只属于一个反应堆线程，所以提交时只需要
+                 release语义写队尾，收割时只需要acquire语义读队尾，不需要任何锁。
+                 BufferRing是注册给内核的提供缓冲区环（IORING_REGISTER_PBUF_RING）：带IOSQE_BUFFER_SELECT的
+                 接收请求由内核从环中取一个缓冲区放数据，完成事件中带上缓冲区编号，用完后由用户放回环中。
+ ************************************************************************/
+
+#ifndef IO_URING_WRAPPER
+#define IO_URING_WRAPPER
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+class IoUring
+{
+public:
+    IoUring();
+    ~IoUring();
+    /*创建有entries个SQE的环，flags是IORING_SETUP_*标志。失败时返回false，errno为失败原因*/
+    bool Init(unsigned entries, unsigned flags);
+    /*取一个空闲的SQE并清零，提交队列满时先提交已有的SQE，仍然没有空位时返回nullptr*/
+    struct io_uring_sqe *GetSqe();
+    /*提交队列中还能取出的SQE数*/
+    unsigned SpaceLeft() const { return sqMask + 1 - (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)); }
+    /*提交所有准备好的SQE，并等待至少waitNr个完成事件，返回io_uring_enter的返回值*/
+    int SubmitAndWait(unsigned waitNr);
+    /*取下一个完成事件，没有时返回nullptr。处理完后必须调用SeenCqe*/
+    struct io_uring_cqe *PeekCqe();
+    /*把PeekCqe取到的完成事件还给内核*/
+    void SeenCqe();
+    /*环的描述符，注册缓冲区环时使用*/
+    int GetFd() const { return ringFd; }
+    /*调用io_uring_enter的次数*/
+    uint64_t EnterCount() const { return enterCount; }
+
+private:
+    int ringFd;
+    /*提交队列*/
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned sqeTail;           //已经分配出去但还没有发布给内核的SQE的队尾
+    /*完成队列*/
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    /*mmap的区域，析构时解除映射*/
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned setupFlags;
+    uint64_t enterCount;
+};
+
+class BufferRing
+{
+public:
+    BufferRing();
+    ~BufferRing();
+    /*分配count个（2的幂）大小为size的缓冲区，以组号groupId注册到ring中，并把它们全部放入环中*/
+    bool Init(IoUring &ring, uint16_t groupId, unsigned count, unsigned size);
+    /*第bufferId个缓冲区的地址*/
+    char *Buffer(uint16_t bufferId) const { return base + (size_t)bufferId * bufferSize; }
+    /*把用完的缓冲区放回环中，调用Commit后内核才能看到*/
+    void Recycle(uint16_t bufferId);
+    /*发布Recycle放回的缓冲区*/
+    void Commit();
+    uint16_t GroupId() const { return groupId; }
+    unsigned BufferSize() const { return bufferSize; }
+
+private:
+    struct io_uring_buf_ring *ring;
+    char *base;
+    unsigned count;
+    unsigned bufferSize;
+    uint16_t groupId;
+    uint16_t tail;              //本地的环尾，Commit时写给内核
+    size_t ringBytes;
+};
+
+#endif
@@ -0,0 +1,234 @@
+/* ************************************************************************
+> File Name:     RingBuffer.h
+> Author:        Luncles
+> 功能：          每个连接的输入环形缓冲区：一次readv填满两段空闲空间，按页增长，空闲时收缩
+> Created Time:  Sun 25 Oct 2026 09:41:17 AM CST
+> Description:   数据在环中首尾相接，空闲空间最多分成两段（队尾到数组末尾、数组开头到队头），
+                 ReadFrom用一次readv把两段一起填上，不需要先把数据移到数组开头。
+                 缓冲区第一次读时才分配一页；一次readv读满了全部空闲空间说明消息比缓冲区大，
+                 下次读之前把容量翻倍（总是整页），最多到maxCapacity，64KB的消息4次readv就能读完；
+                 连续SHRINK_READS次读到的数据都不到容量的四分之一时，容量减半（不小于一页）。
+                 内存从本线程的缓冲区池（BufferPool）中取，Release把内存还给池但记住容量，
+                 连接空闲时只占这个对象本身，再次有数据时按原来的容量从池中取一块刚用过的缓冲区。
+                 缓冲区池是线程局部的，缓冲区要在申请它的线程中释放（Release或析构），不能交给别的线程释放。
+ ************************************************************************/
+
+#ifndef RING_BUFFER
+#define RING_BUFFER
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "BufferPool.h"
+
+#define RING_PAGE_SIZE 4096                 //分配和增长的单位
+#define RING_MAX_CAPACITY (64 * 1024)       //默认的最大容量
+
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t maxCapacity = RING_MAX_CAPACITY) : data(nullptr), capacity(RING_PAGE_SIZE),
+        maxCapacity(maxCapacity), head(0), size(0), smallReads(0), filled(false) { }
+    ~RingBuffer() { BufferPool::Local().Put(data, capacity); }
+    /*缓冲区只能移动，连接表重置表项时用移动赋值*/
+    RingBuffer(RingBuffer &&other) noexcept;
+    RingBuffer &operator=(RingBuffer &&other) noexcept;
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    /*用一次readv把fd上的数据读进空闲空间，最多读maxBytes字节，返回readv的返回值。缓冲区已满时返回-1并把errno设为ENOBUFS*/
+    ssize_t ReadFrom(int fd, size_t maxBytes);
+    /*上一次ReadFrom是否读满了请求的长度。没有读满说明socket已经读空，不必再读一次等EAGAIN*/
+    bool Filled() const { return filled; }
+    /*缓冲区中的字节数*/
+    size_t Size() const { return size; }
+    /*已经分配的内存，没有分配时为0*/
+    size_t Allocated() const { return data ? capacity : 0; }
+    /*把数据填进iov（最多两段），返回段数*/
+    int Peek(struct iovec iov[2]) const;
+    /*丢弃开头的len个字节*/
+    void Consume(size_t len);
+    /*丢弃所有数据并把内存还给缓冲区池，容量保留，下次读时按它取*/
+    void Release();
+
+private:
+    /*把容量改为newCapacity，数据移到数组开头*/
+    void Resize(size_t newCapacity);
+
+private:
+    char *data;
+    size_t capacity;        //当前（或下次分配时）的容量，是RING_PAGE_SIZE的整数倍
+    size_t maxCapacity;
+    size_t head;            //第一个字节的下标
+    size_t size;
+    int smallReads;         //连续读到的数据不到容量四分之一的次数
+    bool filled;
+
+    static const int SHRINK_READS = 16;
+};
+
+inline RingBuffer::RingBuffer(RingBuffer &&other) noexcept : data(other.data), capacity(other.capacity),
+    maxCapacity(other.maxCapacity), head(other.head), size(other.size), smallReads(other.smallReads), filled(other.filled)
+{
+    other.data = nullptr;
+    other.head = other.size = 0;
+}
+
+inline RingBuffer &RingBuffer::operator=(RingBuffer &&other) noexcept
+{
+    if (this != &other)
+    {
+        BufferPool::Local().Put(data, capacity);
+        data = other.data;
+        capacity = other.capacity;
+        maxCapacity = other.maxCapacity;
+        head = other.head;
+        size = other.size;
+        smallReads = other.smallReads;
+        filled = other.filled;
+        other.data = nullptr;
+        other.head = other.size = 0;
+    }
+    return *this;
+}
+
+inline void RingBuffer::Resize(size_t newCapacity)
+{
+    char *newData = BufferPool::Local().Get(newCapacity);
+    if (!newData)
+    {
+        return;
+    }
+    if (data)
+    {
+        struct iovec iov[2];
+        int count = Peek(iov);
+        size_t offset = 0;
+        for (int i = 0; i < count; i++)
+        {
+            memcpy(newData + offset, iov[i].iov_base, iov[i].iov_len);
+            offset += iov[i].iov_len;
+        }
+        BufferPool::Local().Put(data, capacity);
+    }
+    data = newData;
+    capacity = newCapacity;
+    head = 0;
+}
+
+inline ssize_t RingBuffer::ReadFrom(int fd, size_t maxBytes)
+{
+    if (!data)
+    {
+        Resize(capacity);
+        if (!data)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    /*上一次把空闲空间读满了，消息比缓冲区大，容量翻倍（仍是整页），几次就能增长到放得下整条消息*/
+    else if (filled && (size + maxBytes > capacity) && (capacity < maxCapacity))
+    {
+        Resize((capacity * 2 < maxCapacity) ? capacity * 2 : maxCapacity);
+    }
+
+    /*空闲空间的两段：队尾到数组末尾（或到队头），数组开头到队头*/
+    struct iovec iov[2];
+    int count = 0;
+    size_t tail = (head + size) % capacity;
+    size_t want = capacity - size;
+    if (want > maxBytes)
+    {
+        want = maxBytes;
+    }
+    if (want == 0)
+    {
+        filled = false;
+        errno = ENOBUFS;
+        return -1;
+    }
+    size_t first = ((tail >= head) && (size < capacity)) ? capacity - tail : head - tail;
+    if (first > want)
+    {
+        first = want;
+    }
+    iov[count].iov_base = data + tail;
+    iov[count].iov_len = first;
+    count++;
+    if (want > first)
+    {
+        iov[count].iov_base = data;
+        iov[count].iov_len = want - first;
+        count++;
+    }
+
+    ssize_t ret = readv(fd, iov, count);
+    filled = (ret == (ssize_t)want);
+    if (ret > 0)
+    {
+        size += ret;
+        /*一直只用到一小部分时收缩*/
+        if ((size_t)ret * 4 < capacity)
+        {
+            smallReads++;
+        }
+        else
+        {
+            smallReads = 0;
+        }
+    }
+    return ret;
+}
+
+inline int RingBuffer::Peek(struct iovec iov[2]) const
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+    size_t first = (head + size <= capacity) ? size : capacity - head;
+    iov[0].iov_base = data + head;
+    iov[0].iov_len = first;
+    if (first == size)
+    {
+        return 1;
+    }
+    iov[1].iov_base = data;
+    iov[1].iov_len = size - first;
+    return 2;
+}
+
+inline void RingBuffer::Consume(size_t len)
+{
+    if (len >= size)
+    {
+        /*读空时回到数组开头，下一次读的空闲空间是连续的一段*/
+        head = 0;
+        size = 0;
+        if ((smallReads >= SHRINK_READS) && (capacity > RING_PAGE_SIZE))
+        {
+            smallReads = 0;
+            size_t newCapacity = (capacity / 2 + RING_PAGE_SIZE - 1) / RING_PAGE_SIZE * RING_PAGE_SIZE;
+            BufferPool::Local().Put(data, capacity);
+            data = nullptr;
+            capacity = newCapacity;
+        }
+        return;
+    }
+    head = (head + len) % capacity;
+    size -= len;
+}
+
+inline void RingBuffer::Release()
+{
+    BufferPool::Local().Put(data, capacity);
+    data = nullptr;
+    head = 0;
+    size = 0;
+    filled = false;
+}
+
+#endif
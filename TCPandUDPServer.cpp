@@ -17,120 +17,397 @@
 #include <netinet/in.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/signalfd.h>
 #include "ErrorHandling.h"
 #include "init_socket.h"
+#include "EventLoop.h"
+#include "UdpEchoBatch.h"
+#include "TcpConnection.h"
+#include "UringEchoLoop.h"
+#include "Histogram.h"
 
-#define MAX_EVENT_NUMBER 1024
-#define TCP_BUFFER_SIZE 512
-#define UDP_BUFFER_SIZE 1024
+static bool useSplice = false;      //TCP回声是否使用splice模式
+static bool useUring = false;       //是否使用io_uring后端
+static bool useGro = false;         //UDP是否使用GRO接收、GSO回声
+static int spinUs = 0;              //忙轮询的窗口（微秒），0表示不忙轮询
 
+/*
+ * UDP socket的处理器：可读时放进就绪列表，每轮回声一份预算，UDP洪水不能饿死TCP连接
+ */
+class UdpHandler : public EventHandler
+{
+public:
+    virtual void HandleEvent(uint32_t) { GetLoop()->MarkReady(this); }
+    /*边缘触发，用recvmmsg分批读出数据报，再用sendmmsg批量回声，读满预算时下一轮继续*/
+    virtual bool HandleReady() { return batch.Drain(GetFd(), UDP_READ_BUDGET) >= UDP_READ_BUDGET; }
+    /*在udpsock上打开UDP_GRO，内核不支持时返回false*/
+    bool EnableGro(int udpsock) { return batch.EnableGro(udpsock); }
 
+private:
+    UdpEchoBatch batch;         //本反应堆复用的UDP批量收发缓冲区
+};
 
-int main(int argc, char *argv[])
+/*
+ * 反应堆：每个线程一个，拥有自己的事件循环、TCP监听socket和UDP socket。
+ * 在SO_REUSEPORT模式下每个反应堆的socket都是独立的，由内核按四元组哈希分发连接和数据报；
+ * 在EPOLLEXCLUSIVE模式下所有反应堆共享同一对socket，由内核每次只唤醒其中一个反应堆。
+ * 反应堆接受的连接只注册到它自己的事件循环中，热路径上没有跨线程共享的数据。
+ * 监听socket和signalfd是控制描述符，每轮最先处理；连接和UDP socket的读都经过事件循环的就绪列表，
+ * 每轮各读一份预算，一个客户端发得再快也只占一份
+ */
+struct Reactor
 {
-    if (argc != 3)
+    pthread_t tid;
+    EventLoop *loop;
+    int servsock;
+    int udpsock;
+    int sigfd;                  //接收SIGUSR1的signalfd，只注册在第0个反应堆中，其他反应堆为-1
+    CallbackHandler listenHandler;
+    CallbackHandler signalHandler;
+    UdpHandler udpHandler;
+};
+
+static Reactor *reactors = nullptr;
+static int reactorNum = 0;
+
+/*
+ * 功能：合并所有反应堆的统计并打印
+ */
+void PrintStats()
+{
+    LoopStats total;
+    for (int i = 0; i < reactorNum; i++)
     {
-        printf("Usage : %s <ip> <port>\n", argv[0]);
-        exit(1);
+        total.Merge(reactors[i].loop->Stats());
     }
+    printf("stats of %d reactor(s):\n", reactorNum);
+    total.Print();
+    fflush(stdout);
+}
 
-    int servsock, clntsock;
-    int udpsock;
-    const char *ip = argv[1];
-    const char *port = argv[2];
-    struct sockaddr_in servAddr, clntAddr;
-    socklen_t clntAddrSize;
-    int readNum;
+/*
+ * 功能：接受连接后的回调，把连接注册到接受它的反应堆的事件循环中
+ */
+void OnAccept(int clntsock, struct sockaddr_in &, void *arg)
+{
+    Reactor *reactor = (Reactor *)arg;
+    reactor->loop->Add(new TcpConnection(useSplice), clntsock, EPOLLIN | EPOLLRDHUP | EPOLLET);
+}
 
-    InitSocketAddress(servAddr, ip, port);
+/*
+ * 功能：监听socket可读，一次取走积压队列中的连接，最多ACCEPT_BUDGET个，剩下的由水平触发在下一轮继续通知
+ */
+void OnListenReadable(uint32_t, void *arg)
+{
+    Reactor *reactor = (Reactor *)arg;
+    AcceptConnections(reactor->servsock, ACCEPT_BUDGET, OnAccept, reactor);
+}
 
-    servsock = socket(PF_INET, SOCK_STREAM, 0);
-    assert(servsock >= 0);
+/*
+ * 功能：收到SIGUSR1，合并并打印所有反应堆的统计
+ */
+void OnSignalReadable(uint32_t, void *arg)
+{
+    Reactor *reactor = (Reactor *)arg;
+    struct signalfd_siginfo siginfo;
+    while (read(reactor->sigfd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
+    {
+        PrintStats();
+    }
+}
 
-    int ret = bind(servsock, (struct sockaddr *)&servAddr, sizeof(servAddr));
-    assert(ret != -1);
+/*
+ * 功能：检查内核是否支持SO_REUSEPORT。在创建任何反应堆之前调用一次，所有反应堆都用同一种分发方式，
+ *       不会出现一部分反应堆各自绑定、另一部分共享socket的情况
+ */
+bool ReusePortSupported()
+{
+    int sock = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return false;
+    }
+    bool supported = (SetReusePort(sock) != -1);
+    close(sock);
+    return supported;
+}
 
-    ret = listen(servsock, 5);
-    assert(ret != -1);
+/*
+ * 功能：CreateSockets失败时关闭已经创建的socket，保留失败时的errno
+ */
+static void CloseSockets(int &servsock, int &udpsock)
+{
+    int savedErrno = errno;
+    if (servsock >= 0)
+    {
+        close(servsock);
+    }
+    if (udpsock >= 0)
+    {
+        close(udpsock);
+    }
+    servsock = udpsock = -1;
+    errno = savedErrno;
+}
 
-    /*创建UDP socket，并将其绑定到端口上*/
+/*
+ * 功能：创建绑定到ip:port的TCP监听socket和UDP socket，都是非阻塞的，reusePort为true时在bind之前设置SO_REUSEPORT。
+ *       任何一步失败（例如端口被占用）时关闭已经创建的socket并返回false，errno是失败的原因
+ */
+bool CreateSockets(const char *ip, const char *port, bool reusePort, int &servsock, int &udpsock)
+{
+    struct sockaddr_in servAddr;
     InitSocketAddress(servAddr, ip, port);
-    udpsock = socket(PF_INET, SOCK_DGRAM, 0);
-    assert(udpsock >= 0);
-    ret = bind(udpsock, (struct sockaddr *)&servAddr, sizeof(servAddr));
-    assert(ret != -1);
+    udpsock = -1;
+
+    servsock = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if ((servsock < 0) || (reusePort && (SetReusePort(servsock) == -1)) ||
+        (bind(servsock, (struct sockaddr *)&servAddr, sizeof(servAddr)) == -1) ||
+        /*积压队列设为系统上限，连接突发时由AcceptConnections一次取走*/
+        (listen(servsock, SOMAXCONN) == -1))
+    {
+        CloseSockets(servsock, udpsock);
+        return false;
+    }
 
-    epoll_event events[MAX_EVENT_NUMBER];
-    int epollfd = epoll_create(5);
-    assert(epollfd != -1);
+    /*创建UDP socket，并将其绑定到端口上*/
+    udpsock = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if ((udpsock < 0) || (reusePort && (SetReusePort(udpsock) == -1)) ||
+        (bind(udpsock, (struct sockaddr *)&servAddr, sizeof(servAddr)) == -1))
+    {
+        CloseSockets(servsock, udpsock);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * 反应堆线程：在自己的事件循环中处理TCP连接、UDP数据报和客户数据
+ */
+void *ReactorMain(void *arg)
+{
+    Reactor *reactor = (Reactor *)arg;
+    reactor->loop->Run();
+    return NULL;
+}
 
-    /*注册TCP socket和UDP socket上的可读事件*/
-    addfd(epollfd, servsock);
-    addfd(epollfd, udpsock);
+/*
+ * io_uring后端的反应堆线程：环必须在使用它的线程中创建。创建失败时退回epoll事件循环，
+ * 所以反应堆的socket总是也注册在它的事件循环中
+ */
+void *UringReactorMain(void *arg)
+{
+    Reactor *reactor = (Reactor *)arg;
+    UringEchoLoop loop(reactor->servsock, reactor->udpsock, reactor->sigfd, &reactor->loop->Stats(), PrintStats);
+    if (!loop.Init())
+    {
+        printf("io_uring setup failed, reactor falls back to epoll\n");
+        return ReactorMain(arg);
+    }
+    loop.Run();
+    return NULL;
+}
 
-    while (1)
+/*
+ * 用法：reactorNum为反应堆（线程）数，0表示与CPU核数相同，默认为1；
+ *       mode为reuseport（默认，每个反应堆独立的socket）或exclusive（共享socket，以EPOLLEXCLUSIVE注册）；
+ *       echo为copy（默认，recv/send经过用户空间缓冲区）或splice（socket -> 管道 -> socket，不经过用户空间）；
+ *       backend为epoll（默认）或uring（io_uring，内核不支持时退回epoll，回声总是直接从接收缓冲区发出）；
+ *       udp为plain（默认，逐个数据报收发）或gro（UDP_GRO合并接收、UDP_SEGMENT分段回声，只用于epoll后端）；
+ *       spinUs为忙轮询的窗口（微秒，默认0表示不忙轮询）：有事件后这段时间内epoll_wait不阻塞，只用于epoll后端
+ */
+int main(int argc, char *argv[])
+{
+    if ((argc < 3) || (argc > 9))
     {
-        /*等待事件发生*/
-        int eventsNum = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        printf("Usage : %s <ip> <port> [reactorNum] [reuseport|exclusive] [copy|splice] [epoll|uring] [plain|gro] [spinUs]\n", argv[0]);
+        exit(1);
+    }
 
-        if (eventsNum < 0)
+    const char *ip = argv[1];
+    const char *port = argv[2];
+    reactorNum = (argc >= 4) ? atoi(argv[3]) : 1;
+    if (reactorNum <= 0)
+    {
+        reactorNum = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    bool reusePort = true;
+    if (argc >= 5)
+    {
+        if (strcmp(argv[4], "exclusive") == 0)
         {
-            printf("epoll failure\n");
-            break;
+            reusePort = false;
         }
-        for (int i = 0; i < eventsNum; i++)
+        else if (strcmp(argv[4], "reuseport") != 0)
         {
-            int sockfd = events[i].data.fd;
-            if (sockfd == servsock)         //发生连接请求事件
-            {
-                clntAddrSize = sizeof(clntAddr);
-                clntsock = accept(servsock, (struct sockaddr *)&clntAddr, &clntAddrSize);
-                addfd(epollfd, clntsock);
-            }
-            else if (sockfd == udpsock)     //UDP事件
+            ErrorHandling("mode must be reuseport or exclusive");
+        }
+    }
+    if (argc >= 6)
+    {
+        if (strcmp(argv[5], "splice") == 0)
+        {
+            useSplice = true;
+        }
+        else if (strcmp(argv[5], "copy") != 0)
+        {
+            ErrorHandling("echo must be copy or splice");
+        }
+    }
+    if (argc >= 7)
+    {
+        if (strcmp(argv[6], "uring") == 0)
+        {
+            useUring = true;
+        }
+        else if (strcmp(argv[6], "epoll") != 0)
+        {
+            ErrorHandling("backend must be epoll or uring");
+        }
+    }
+    if (useUring && !UringEchoLoop::Supported())
+    {
+        printf("io_uring (provided buffer rings, multishot recv) unavailable, falling back to epoll\n");
+        useUring = false;
+    }
+    if (argc >= 8)
+    {
+        if (strcmp(argv[7], "gro") == 0)
+        {
+            useGro = true;
+        }
+        else if (strcmp(argv[7], "plain") != 0)
+        {
+            ErrorHandling("udp must be plain or gro");
+        }
+    }
+    if (argc == 9)
+    {
+        spinUs = atoi(argv[8]);
+    }
+    if (useUring && useSplice)
+    {
+        printf("the io_uring backend echoes from its receive buffers, splice is ignored\n");
+    }
+    if (useUring && useGro)
+    {
+        printf("the io_uring backend receives datagrams one by one, gro is ignored\n");
+        useGro = false;
+    }
+    if (useUring && (spinUs > 0))
+    {
+        printf("the io_uring backend always blocks in io_uring_enter, spinUs is ignored\n");
+        spinUs = 0;
+    }
+    /*只有一个反应堆时，不需要任何分发机制*/
+    if (reactorNum == 1)
+    {
+        reusePort = false;
+    }
+    /*内核不支持SO_REUSEPORT时，退回到共享socket加EPOLLEXCLUSIVE的方式。在创建反应堆之前决定，所有反应堆一致*/
+    if (reusePort && !ReusePortSupported())
+    {
+        printf("SO_REUSEPORT unavailable, falling back to EPOLLEXCLUSIVE\n");
+        reusePort = false;
+    }
+    /*UDP_GRO同样在创建反应堆之前检查一次，不会出现一部分反应堆合并接收、另一部分逐个接收的情况*/
+    if (useGro && !UdpEchoBatch::GroSupported())
+    {
+        printf("UDP_GRO unavailable, datagrams are echoed one by one\n");
+        useGro = false;
+    }
+
+    /*在创建反应堆线程之前屏蔽SIGUSR1，所有线程都继承这个屏蔽字，信号只通过signalfd交给第0个反应堆*/
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(sigfd != -1);
+
+    reactors = new Reactor[reactorNum];
+    int sharedServsock = -1, sharedUdpsock = -1;
+    for (int i = 0; i < reactorNum; i++)
+    {
+        Reactor *reactor = &reactors[i];
+        reactor->loop = new EventLoop();
+        reactor->sigfd = -1;
+        if (reusePort)
+        {
+            if (!CreateSockets(ip, port, true, reactor->servsock, reactor->udpsock))
             {
-                char buf[UDP_BUFFER_SIZE];
-                memset(buf, '\0', UDP_BUFFER_SIZE);
-                clntAddrSize = sizeof(clntAddr);
-                readNum = recvfrom(udpsock, buf, UDP_BUFFER_SIZE - 1, 0, (struct sockaddr *)&clntAddr, &clntAddrSize);
-                if (readNum > 0)
-                {
-                    sendto(udpsock, buf, UDP_BUFFER_SIZE - 1, 0, (struct sockaddr *)&clntAddr, clntAddrSize);
-                }
+                perror("bind");
+                ErrorHandling("cannot create the reactor's SO_REUSEPORT sockets");
             }
-            else if (events[i].events & EPOLLIN)
+        }
+        else
+        {
+            if ((sharedServsock < 0) && !CreateSockets(ip, port, false, sharedServsock, sharedUdpsock))
             {
-                char buf[TCP_BUFFER_SIZE];
-                while (1)
-                {
-                    memset(buf, '\0', TCP_BUFFER_SIZE);
-                    ret = recv(sockfd, buf, TCP_BUFFER_SIZE - 1, 0);
-                    if (ret < 0)
-                    {
-                        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-                        {
-                            break;
-                        }
-                        close(sockfd);
-                        break;  
-                    }
-                    else if (ret == 0)
-                    {
-                        close(sockfd);
-                        break;
-                    }
-                    else 
-                    {
-                        send(sockfd, buf, ret, 0);
-                    }
-                }
+                perror("bind");
+                ErrorHandling("cannot create the shared sockets");
             }
-            else
+            reactor->servsock = sharedServsock;
+            reactor->udpsock = sharedUdpsock;
+        }
+        /*内核支持UDP_GRO时，在某个socket上打开失败是意外的错误，不能让反应堆之间的模式不一致*/
+        if (useGro && !reactor->udpHandler.EnableGro(reactor->udpsock))
+        {
+            perror("setsockopt");
+            ErrorHandling("cannot enable UDP_GRO on the reactor's socket");
+        }
+        /*忙轮询：有事件后spinUs微秒内不阻塞；socket同时打开内核忙轮询，接受的连接继承这个设置*/
+        if (spinUs > 0)
+        {
+            reactor->loop->SetBusyPoll(spinUs);
+            if ((SetBusyPoll(reactor->servsock, spinUs) == -1) || (SetBusyPoll(reactor->udpsock, spinUs) == -1))
             {
-                printf("something else happened\n");
+                printf("SO_BUSY_POLL unavailable, spinning in epoll_wait only\n");
             }
         }
+
+        /*注册TCP socket和UDP socket上的可读事件。监听socket是水平触发的，一轮没有接受完的连接下一轮还会被通知；
+         *多个反应堆共享socket时加上EPOLLEXCLUSIVE，事件到来时内核只唤醒其中一个反应堆*/
+        uint32_t exclusive = (reusePort || (reactorNum == 1)) ? 0u : (uint32_t)EPOLLEXCLUSIVE;
+        reactor->listenHandler.SetCallback(OnListenReadable, reactor);
+        reactor->loop->Add(&reactor->listenHandler, reactor->servsock, EPOLLIN | exclusive, true);
+        reactor->loop->Add(&reactor->udpHandler, reactor->udpsock, EPOLLIN | EPOLLET | exclusive);
+    }
+
+    reactors[0].sigfd = sigfd;
+    reactors[0].signalHandler.SetCallback(OnSignalReadable, &reactors[0]);
+    reactors[0].loop->Add(&reactors[0].signalHandler, sigfd, EPOLLIN | EPOLLET, true);
+
+    /*主线程自己充当第0个反应堆*/
+    void *(*reactorMain)(void *) = useUring ? UringReactorMain : ReactorMain;
+    for (int i = 1; i < reactorNum; i++)
+    {
+        int ret = pthread_create(&reactors[i].tid, NULL, reactorMain, &reactors[i]);
+        assert(ret == 0);
+    }
+    reactorMain(&reactors[0]);
+
+    for (int i = 1; i < reactorNum; i++)
+    {
+        pthread_join(reactors[i].tid, NULL);
+    }
+    for (int i = 0; i < reactorNum; i++)
+    {
+        delete reactors[i].loop;
+        if (reusePort)
+        {
+            close(reactors[i].servsock);
+            close(reactors[i].udpsock);
+        }
+    }
+    if (!reusePort)
+    {
+        close(sharedServsock);
+        close(sharedUdpsock);
     }
-    close(servsock);
+    close(sigfd);
+    delete[] reactors;
     return 0;
-}
\ No newline at end of file
+}
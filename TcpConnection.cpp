@@ -0,0 +1,325 @@
+/* ************************************************************************
+> File Name:     TcpConnection.cpp
+> Author:        Luncles
+> 功能：          回声服务器的TCP连接，带有输出缓冲区和EPOLLOUT背压
+> Created Time:  Sun 18 Oct 2026 02:47:12 PM CST
+> Description:   
+ ************************************************************************/
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <string.h>
+#include <errno.h>
+#include "TcpConnection.h"
+
+TcpConnection::TcpConnection(bool useSplice) : outHead(0), readPaused(false), moreToRead(false), peerClosed(false), inputClosed(false), pipeBytes(0)
+{
+    pipeFds[0] = pipeFds[1] = -1;
+    if (useSplice && (pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) == -1))
+    {
+        pipeFds[0] = pipeFds[1] = -1;
+    }
+}
+
+TcpConnection::~TcpConnection()
+{
+    if (pipeFds[0] >= 0)
+    {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+}
+
+void TcpConnection::HandleEvent(uint32_t events)
+{
+    if (events & (EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+    {
+        peerClosed = true;
+    }
+    /*可写时立即发送积压的数据；可读时放进就绪列表，本轮事件全部分发完后再读。
+     *已经读到0时不再读，出错或挂断也交给HandleWrite：发送出错就关闭*/
+    if (inputClosed)
+    {
+        if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && !HandleWrite())
+        {
+            GetLoop()->Close(this);
+        }
+    }
+    else if ((events & EPOLLOUT) && !HandleWrite())
+    {
+        GetLoop()->Close(this);
+    }
+    else if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+    {
+        GetLoop()->MarkReady(this);
+    }
+}
+
+bool TcpConnection::HandleReady()
+{
+    if (!HandleRead())
+    {
+        GetLoop()->Close(this);
+        return false;
+    }
+    return moreToRead;
+}
+
+bool TcpConnection::HandleRead()
+{
+    moreToRead = false;
+    if (pipeFds[0] >= 0)
+    {
+        return SpliceRead();
+    }
+    int calls = 0;
+    size_t bytes = 0;
+    /*边缘触发，要一直读到内核中没有数据；但输出缓冲区超过高水位时停下，剩余的数据留在内核中，恢复读时再处理。
+     *读满预算时也停下，数据留到下一轮再读*/
+    while (!readPaused)
+    {
+        if ((calls >= READ_BUDGET_CALLS) || (bytes >= READ_BUDGET_BYTES))
+        {
+            moreToRead = true;
+            break;
+        }
+        calls++;
+        ssize_t ret = input.ReadFrom(GetFd(), READ_BUDGET_BYTES - bytes);
+        if (ret < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        else if (ret == 0)
+        {
+            inputClosed = true;
+            break;
+        }
+        bytes += ret;
+        struct iovec iov[2];
+        int count = input.Peek(iov);
+        for (int i = 0; i < count; i++)
+        {
+            if (!Send((const char *)iov[i].iov_base, iov[i].iov_len))
+            {
+                return false;
+            }
+        }
+        input.Consume(input.Size());
+        if (PendingBytes() >= HIGH_WATER_MARK)
+        {
+            readPaused = true;
+        }
+        /*没有读满说明内核中的数据已经读完，不必再读一次等EAGAIN；对端已经关闭时还要接着读，直到读到0*/
+        if (!input.Filled() && !peerClosed)
+        {
+            break;
+        }
+    }
+    /*这一批读完了就释放输入缓冲区，空闲的连接不占缓冲区内存；读满预算时下一轮马上还要用，先留着*/
+    if (!moreToRead)
+    {
+        input.Release();
+    }
+    /*对端半关闭：回声已经发完就关闭，否则等EPOLLOUT把它发完*/
+    if (inputClosed && (PendingBytes() == 0))
+    {
+        return false;
+    }
+    UpdateEvents();
+    return true;
+}
+
+bool TcpConnection::HandleWrite()
+{
+    if (!((pipeFds[0] >= 0) ? FlushPipe() : FlushOutput()))
+    {
+        return false;
+    }
+    /*对端取走了足够多的数据，恢复读。重新关注EPOLLIN时，如果内核中还有数据，边缘触发会再次通知*/
+    if (readPaused && (PendingBytes() <= LOW_WATER_MARK))
+    {
+        readPaused = false;
+    }
+    /*对端已经半关闭，积压的回声全部发完后关闭连接*/
+    if (inputClosed && (PendingBytes() == 0))
+    {
+        return false;
+    }
+    UpdateEvents();
+    return true;
+}
+
+bool TcpConnection::Send(const char *data, int len)
+{
+    int sent = 0;
+    /*缓冲区中还有数据时不能直接发送，否则会打乱字节顺序*/
+    if (PendingBytes() == 0)
+    {
+        while (sent < len)
+        {
+            int ret = send(GetFd(), data + sent, len - sent, MSG_NOSIGNAL);
+            if (ret < 0)
+            {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                {
+                    break;
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            sent += ret;
+        }
+    }
+    if (sent < len)
+    {
+        outBuffer.insert(outBuffer.end(), data + sent, data + len);
+    }
+    return true;
+}
+
+bool TcpConnection::FlushOutput()
+{
+    while (PendingBytes() > 0)
+    {
+        int ret = send(GetFd(), &outBuffer[outHead], PendingBytes(), MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        outHead += ret;
+    }
+    /*全部发完时清空缓冲区；已发送的部分超过一半时再整体前移，避免每次发送都移动数据*/
+    if (PendingBytes() == 0)
+    {
+        outBuffer.clear();
+        outHead = 0;
+    }
+    else if (outHead > outBuffer.size() / 2)
+    {
+        outBuffer.erase(outBuffer.begin(), outBuffer.begin() + outHead);
+        outHead = 0;
+    }
+    return true;
+}
+
+/*
+ * 管道容量有限，而且一次splice进来的数据可能占用多个管道槽位，所以从socket splice到管道返回EAGAIN时，
+ * 分不清是socket空了还是管道满了。每次splice之前先把管道发空：发不空说明对端接收慢，暂停读等EPOLLOUT；
+ * 管道是空的时候返回EAGAIN就一定是socket已经读完
+ */
+bool TcpConnection::SpliceRead()
+{
+    int calls = 0;
+    size_t bytes = 0;
+    while (!readPaused)
+    {
+        if ((calls >= READ_BUDGET_CALLS) || (bytes >= READ_BUDGET_BYTES))
+        {
+            moreToRead = true;
+            break;
+        }
+        calls++;
+        if (!FlushPipe())
+        {
+            return false;
+        }
+        if (pipeBytes > 0)
+        {
+            readPaused = true;
+            break;
+        }
+        ssize_t ret = splice(GetFd(), NULL, pipeFds[1], NULL, READ_BUDGET_BYTES - bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (ret < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        else if (ret == 0)
+        {
+            inputClosed = true;
+            break;
+        }
+        pipeBytes += ret;
+        bytes += ret;
+    }
+    /*对端半关闭：管道中的数据发完后关闭*/
+    if (inputClosed && !FlushPipe())
+    {
+        return false;
+    }
+    if (inputClosed && (pipeBytes == 0))
+    {
+        return false;
+    }
+    UpdateEvents();
+    return true;
+}
+
+bool TcpConnection::FlushPipe()
+{
+    while (pipeBytes > 0)
+    {
+        ssize_t ret = splice(pipeFds[0], NULL, GetFd(), NULL, pipeBytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (ret < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        pipeBytes -= ret;
+    }
+    return true;
+}
+
+/*
+ * 只有输出缓冲区非空时才关注EPOLLOUT，否则边缘触发下每次对端确认数据都会产生无用的唤醒。
+ * 读到0以后只关注EPOLLOUT
+ */
+void TcpConnection::UpdateEvents()
+{
+    uint32_t newEvents = EPOLLET | (inputClosed ? 0u : (uint32_t)EPOLLRDHUP);
+    if (!readPaused && !inputClosed)
+    {
+        newEvents |= EPOLLIN;
+    }
+    if (PendingBytes() > 0)
+    {
+        newEvents |= EPOLLOUT;
+    }
+    /*事件循环在本轮结束时才提交，事件没有变化时不做系统调用*/
+    GetLoop()->Modify(this, newEvents);
+}
@@ -0,0 +1,78 @@
+/* ************************************************************************
+> File Name:     TcpConnection.h
+> Author:        Luncles
+> 功能：          回声服务器的TCP连接，带有输出缓冲区和EPOLLOUT背压
+> Created Time:  Sun 18 Oct 2026 02:47:12 PM CST
+> Description:   send没有发完的数据存入连接自己的输出缓冲区，只有缓冲区非空时才关注EPOLLOUT；
+                 缓冲区超过高水位时停止读这个连接（不再关注EPOLLIN），对端把数据取走、缓冲区降到
+                 低水位以下后再恢复读。慢客户端因此不会让服务器丢数据或无限占用内存，也不会拖慢其他连接。
+                 splice模式下每个连接有一个自己的管道，数据用splice从socket移到管道、再从管道移回socket，
+                 不经过用户空间；管道本身充当输出缓冲区，管道中的数据发不出去时暂停读。
+                 连接是事件循环的处理器：可读时把自己放进就绪列表，由HandleReady读一份预算
+                 （最多READ_BUDGET_CALLS次或READ_BUDGET_BYTES字节），读满预算时数据可能还没读完，
+                 留到下一轮继续读，一个发得快的客户端不能霸占事件循环。连接出错或关闭时由事件循环关闭描述符，
+                 本轮结束时在OnClosed中释放自己。
+                 复制模式的输入缓冲区是一个按需增长的环形缓冲区，每次用一次readv读，大消息几次就能读完；
+                 readv没有读满说明内核中已经没有数据，不再多调用一次等EAGAIN。为此连接关注EPOLLRDHUP：
+                 对端关闭写时即使没读满也接着读，直到读到0，不会因为FIN和最后的数据一起到达而漏掉关闭。
+                 读到0（对端半关闭）后不再读，但输出缓冲区和管道中还没发出去的回声要发完：继续关注EPOLLOUT，
+                 全部发完或者发送出错时才关闭连接。
+ ************************************************************************/
+
+#ifndef TCP_CONNECTION
+#define TCP_CONNECTION
+
+#include <stdint.h>
+#include <vector>
+#include "EventLoop.h"
+#include "RingBuffer.h"
+
+#define HIGH_WATER_MARK (64 * 1024)     //输出缓冲区超过它时暂停读
+#define LOW_WATER_MARK (16 * 1024)      //输出缓冲区降到它以下时恢复读
+#define READ_BUDGET_CALLS 16            //一次HandleRead中最多调用readv（splice）的次数
+#define READ_BUDGET_BYTES (64 * 1024)   //一次HandleRead中最多读的字节数
+
+class TcpConnection : public EventHandler
+{
+public:
+    /*useSplice为true时以splice模式回声，创建管道失败时退回复制模式。创建后以EPOLLIN | EPOLLRDHUP | EPOLLET注册到事件循环中*/
+    TcpConnection(bool useSplice = false);
+    ~TcpConnection();
+    /*可写时发送积压的数据，可读时放进就绪列表*/
+    virtual void HandleEvent(uint32_t events);
+    /*读一份预算并回声，读满预算时返回true*/
+    virtual bool HandleReady();
+    /*描述符已经关闭，释放连接*/
+    virtual void OnClosed() { delete this; }
+
+private:
+    /*在预算内读出数据并回声，返回false表示连接应被关闭*/
+    bool HandleRead();
+    /*发送输出缓冲区中的数据，返回false表示连接应被关闭*/
+    bool HandleWrite();
+    /*发送数据：输出缓冲区为空时直接发送，发不完的部分追加到缓冲区。返回false表示连接出错*/
+    bool Send(const char *data, int len);
+    /*尽量多地发送输出缓冲区中的数据，返回false表示连接出错*/
+    bool FlushOutput();
+    /*splice模式的读：socket -> 管道 -> socket，返回false表示连接应被关闭*/
+    bool SpliceRead();
+    /*把管道中的数据splice到socket，返回false表示连接出错*/
+    bool FlushPipe();
+    /*输出缓冲区（splice模式下是管道）中等待发送的字节数*/
+    size_t PendingBytes() const { return outBuffer.size() - outHead + pipeBytes; }
+    /*根据输出缓冲区的状态更新在epoll中关注的事件*/
+    void UpdateEvents();
+
+private:
+    std::vector<char> outBuffer;    //输出缓冲区
+    size_t outHead;                 //输出缓冲区中第一个未发送字节的下标
+    bool readPaused;                //是否因为输出缓冲区超过高水位而暂停读
+    bool moreToRead;                //上一次HandleRead读满了预算，socket中可能还有数据
+    bool peerClosed;                //对端已经关闭写（EPOLLRDHUP）
+    bool inputClosed;               //已经读到0，不再读，积压的回声发完后关闭
+    RingBuffer input;               //复制模式的输入缓冲区
+    int pipeFds[2];                 //splice模式的管道，复制模式下为-1
+    size_t pipeBytes;               //管道中等待发送的字节数
+};
+
+#endif
@@ -0,0 +1,156 @@
+/* ************************************************************************
+> File Name:     ThreadPool.h
+> Author:        Luncles
+> 功能：          固定大小的工作线程池，带有界任务队列
+> Created Time:  Sat 17 Oct 2026 10:12:05 AM CST
+> Description:   线程数在创建时固定（通常等于CPU核数），主线程（反应堆）通过Append向任务队列投递任务，
+                 队列满时Append阻塞，以此对反应堆形成背压，线程数和排队任务数都不会无限增长。
+                 模板参数T必须提供void Process()成员函数。
+ ************************************************************************/
+
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <pthread.h>
+#include <exception>
+
+template <typename T>
+class ThreadPool
+{
+public:
+    /*threadNum是线程池中线程的数量，maxRequests是任务队列中最多允许的、等待处理的任务数量*/
+    ThreadPool(int threadNum, int maxRequests);
+    ~ThreadPool();
+    /*往任务队列中添加任务，队列满时阻塞，线程池已停止时返回false*/
+    bool Append(T *request);
+
+private:
+    /*工作线程运行的函数，它不断从任务队列中取出任务并执行*/
+    static void *Worker(void *arg);
+    void Run();
+
+private:
+    int threadNum;              //线程池中的线程数
+    int maxRequests;            //任务队列的容量
+    pthread_t *threads;         //描述线程池的数组
+    T **queue;                  //环形任务队列
+    int queueHead;              //队头下标
+    int queueSize;              //队列中的任务数
+    pthread_mutex_t queueLocker;    //保护任务队列的互斥锁
+    pthread_cond_t notEmpty;        //队列非空条件，唤醒工作线程
+    pthread_cond_t notFull;         //队列非满条件，唤醒阻塞的投递者
+    bool stop;                  //是否结束线程
+};
+
+template <typename T>
+ThreadPool<T>::ThreadPool(int threadNum, int maxRequests) :
+    threadNum(threadNum), maxRequests(maxRequests), threads(nullptr), queue(nullptr),
+    queueHead(0), queueSize(0), stop(false)
+{
+    if ((threadNum <= 0) || (maxRequests <= 0))
+    {
+        throw std::exception();
+    }
+    queue = new T*[maxRequests];
+    threads = new pthread_t[threadNum];
+    pthread_mutex_init(&queueLocker, NULL);
+    pthread_cond_init(&notEmpty, NULL);
+    pthread_cond_init(&notFull, NULL);
+
+    /*创建threadNum个线程，线程数量在整个生命周期内保持不变*/
+    for (int i = 0; i < threadNum; i++)
+    {
+        if (pthread_create(threads + i, NULL, Worker, this) != 0)
+        {
+            delete[] threads;
+            delete[] queue;
+            throw std::exception();
+        }
+    }
+}
+
+/*
+ * 析构函数：通知所有工作线程退出并回收它们，队列中尚未处理的任务不再执行
+ */
+template <typename T>
+ThreadPool<T>::~ThreadPool()
+{
+    pthread_mutex_lock(&queueLocker);
+    stop = true;
+    pthread_cond_broadcast(&notEmpty);
+    pthread_cond_broadcast(&notFull);
+    pthread_mutex_unlock(&queueLocker);
+    for (int i = 0; i < threadNum; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&notFull);
+    pthread_cond_destroy(&notEmpty);
+    pthread_mutex_destroy(&queueLocker);
+    delete[] threads;
+    delete[] queue;
+}
+
+/*
+ * 投递任务：任务队列是有界的，满了就等待工作线程取走任务，而不是无限制地排队
+ */
+template <typename T>
+bool ThreadPool<T>::Append(T *request)
+{
+    pthread_mutex_lock(&queueLocker);
+    while ((queueSize == maxRequests) && !stop)
+    {
+        pthread_cond_wait(&notFull, &queueLocker);
+    }
+    if (stop)
+    {
+        pthread_mutex_unlock(&queueLocker);
+        return false;
+    }
+    queue[(queueHead + queueSize) % maxRequests] = request;
+    queueSize++;
+    pthread_cond_signal(&notEmpty);
+    pthread_mutex_unlock(&queueLocker);
+    return true;
+}
+
+template <typename T>
+void *ThreadPool<T>::Worker(void *arg)
+{
+    ThreadPool *pool = (ThreadPool *)arg;
+    pool->Run();
+    return pool;
+}
+
+/*
+ * 工作线程的主循环：队列为空时睡眠在条件变量上，取到任务后在锁外执行
+ */
+template <typename T>
+void ThreadPool<T>::Run()
+{
+    while (1)
+    {
+        pthread_mutex_lock(&queueLocker);
+        while ((queueSize == 0) && !stop)
+        {
+            pthread_cond_wait(&notEmpty, &queueLocker);
+        }
+        if (stop)
+        {
+            pthread_mutex_unlock(&queueLocker);
+            break;
+        }
+        T *request = queue[queueHead];
+        queueHead = (queueHead + 1) % maxRequests;
+        queueSize--;
+        pthread_cond_signal(&notFull);
+        pthread_mutex_unlock(&queueLocker);
+
+        if (request)
+        {
+            request->Process();
+        }
+    }
+}
+
+#endif
@@ -3,7 +3,7 @@
 TimeHeap::TimeHeap(int cap) throw(std::exception) : capacity(cap), curSize(0)
 {
     //注意，此时数组的每个元素都是指针，还没有指向有效的内存地址
-    array = new HeapTimeNode*[capacity];       //new一个包含HeapTimeNode指针的数组
+    array = new TimerNode*[capacity];       //new一个包含TimerNode指针的数组
     if (!array)
     {
         throw std::exception();
@@ -14,7 +14,7 @@ TimeHeap::TimeHeap(int cap) throw(std::exception) : capacity(cap), curSize(0)
     }
 }
 
-TimeHeap::TimeHeap(HeapTimeNode **init_array, int size, int cap) throw(std::exception) : capacity(cap), curSize(size)
+TimeHeap::TimeHeap(TimerNode **init_array, int size, int cap) throw(std::exception) : capacity(cap), curSize(size)
 {
     if (cap < size)                         //容量不能比当前元素小
     {
@@ -22,7 +22,7 @@ TimeHeap::TimeHeap(HeapTimeNode **init_array, int size, int cap) throw(std::exce
     }
 
     //创建堆数组
-    array = new HeapTimeNode *[capacity];
+    array = new TimerNode *[capacity];
     if (!array)
     {
         throw std::exception();
@@ -34,15 +34,16 @@ TimeHeap::TimeHeap(HeapTimeNode **init_array, int size, int cap) throw(std::exce
     }
 
     //初始化堆数组
-    if (!size)
+    if (size)
     {
         for (int i = 0; i < size; i++)
         {
-            array[i] = init_array[i];
+            SetNode(i, init_array[i]);
+            init_array[i]->pending = true;
         }
 
-        //接下来调整堆中结点的位置，只需要调整非叶子结点的位置，而在完全二叉树中，非叶子结点的个数为n/2(n为偶数)或(n-1)/2(n为奇数)
-        for (int i = (curSize - 1) / 2; i >= 0; i--)
+        //接下来调整堆中结点的位置，只需要调整非叶子结点的位置，在4叉堆中，最后一个非叶子结点是最后一个结点的父结点
+        for (int i = (curSize - 2) / ARITY; i >= 0; i--)
         {
             //从最后一个非叶子结点开始进行下虑操作：即当前结点和其子结点进行比较
             PercolateDown(i);
@@ -55,10 +56,11 @@ TimeHeap::TimeHeap(HeapTimeNode **init_array, int size, int cap) throw(std::exce
  */
 TimeHeap::~TimeHeap()
 {
-    //因为在构造函数中，array的元素只是capacity个指针，而实际指向有效内存空间的是curSize个指针，因此需要销毁这些内存空间，然后再销毁掉指针数组
+    //结点的内存属于调用者，这里只把它们标记为不在堆中，然后销毁指针数组
     for (int i = 0; i < curSize; i++)
     {
-        delete array[i];
+        array[i]->heapIndex = -1;
+        array[i]->pending = false;
     }
     delete[] array;
 }
@@ -66,7 +68,7 @@ TimeHeap::~TimeHeap()
 /*
  * 添加目标定时器节点
  */
-void TimeHeap::AddTimerNode(HeapTimeNode *timer) throw(std::exception)
+void TimeHeap::AddTimerNode(TimerNode *timer) throw(std::exception)
 {
     if (!timer)
     {
@@ -77,42 +79,70 @@ void TimeHeap::AddTimerNode(HeapTimeNode *timer) throw(std::exception)
         ResizeArray();
     }
 
-    //新插入了一个元素，则堆大小要加1，hole是当前新建空穴的位置
+    //新插入了一个元素，则堆大小要加1，新结点先放在数组末尾，再执行上虑操作
     int hole = curSize;     
     curSize++;
+    timer->pending = true;
+    SetNode(hole, timer);
+    PercolateUp(hole);
+}
 
-    int parent = 0;
-    
-    //对从空穴到根节点上的路径的所有节点执行上虑操作，即本节点和父节点进行比较
-    for (; hole > 0; hole = parent)
+/*
+ * 删除目标定时器节点：用数组的最后一个结点填补它的位置，再视情况上虑或下虑
+ */
+void TimeHeap::DeleteTimerNode(TimerNode *timer)
+{
+    if (!timer || (timer->heapIndex < 0))
     {
-        parent = (hole - 1) / 2;
-        if (array[parent]->expireTimer <= timer->expireTimer)
-        {
-            break;
-        }
-        array[hole] = array[parent];
+        return;
+    }
+    int hole = timer->heapIndex;
+    curSize--;
+    TimerNode *last = array[curSize];
+    array[curSize] = NULL;
+    timer->heapIndex = -1;
+    timer->pending = false;
+    if (hole == curSize)            //删除的就是最后一个结点
+    {
+        return;
+    }
+    SetNode(hole, last);
+    //填补的结点可能比原位置的父结点小，也可能比子结点大
+    if ((hole > 0) && (last->expire < array[(hole - 1) / ARITY]->expire))
+    {
+        PercolateUp(hole);
+    }
+    else
+    {
+        PercolateDown(hole);
     }
-    array[hole] = timer;
 }
 
 /*
- * 删除目标定时器节点
+ * 调整目标定时器节点：超时时间提前则上虑，推后则下虑
  */
-void TimeHeap::DeleteTimerNode(HeapTimeNode *timer)
+void TimeHeap::AdjustTimerNode(TimerNode *timer, int64_t expire)
 {
-    if (!timer)
+    if (!timer || (timer->heapIndex < 0))
     {
         return;
     }
-    //在这里只是将目标定时器的回调函数设置为空，用到了所谓的延迟销毁。将会节省真正删除该定时器造成的开销，但这样容易使堆数组膨胀
-    timer->CallBack = NULL;
+    int64_t oldExpire = timer->expire;
+    timer->expire = expire;
+    if (expire < oldExpire)
+    {
+        PercolateUp(timer->heapIndex);
+    }
+    else if (expire > oldExpire)
+    {
+        PercolateDown(timer->heapIndex);
+    }
 }
 
 /*
  * 获得堆根节点
  */
-HeapTimeNode* TimeHeap::TopTimer() const
+TimerNode* TimeHeap::TopTimer() const
 {
     if (HeapEmpty())
     {
@@ -122,7 +152,7 @@ HeapTimeNode* TimeHeap::TopTimer() const
 }
 
 /*
- * 删除堆根节点：先检查堆数组是否为空，再检查堆根节点是否存在，删完之后要对堆数组进行调整
+ * 删除堆根节点
  */
 void TimeHeap::PopTimer()
 {
@@ -130,93 +160,104 @@ void TimeHeap::PopTimer()
     {
         return;
     }
-    if (array[0])
-    {
-        DeleteTimerNode(array[0]);
-        //将原来数组的最后一个节点放到根节点，然后进行下虑
-        array[0] = array[curSize - 1];
-        PercolateDown(0);
-    }
+    DeleteTimerNode(array[0]);
 }
 
 /*
  * 心跳函数：以堆数组根节点的超时时间为触发时间
  */
-void TimeHeap::Tick()
+void TimeHeap::TickTo(int64_t now)
 {
-    HeapTimeNode *tmp = array[0];
-    time_t curTime = time(NULL);        //循环处理堆中到期的定时器
+    //循环处理堆中到期的定时器
     while (!HeapEmpty())
     {
-        if (!tmp)
-        {
-            break;
-        }
-        
+        TimerNode *tmp = array[0];
         //如果堆顶定时器还没到期，就退出循环
-        if (tmp->expireTimer > curTime)
+        if (tmp->expire > now)
         {
             break;
         }
-        //否则就执行堆顶定时器的任务
-        if (array[0]->CallBack)
+        //否则先将根节点从堆中删除，再执行它的任务，这样回调中可以安全地增删其他定时器
+        DeleteTimerNode(tmp);
+        if (tmp->callback)
         {
             //回调函数
-            array[0]->CallBack(array[0]->userData);
+            tmp->callback(tmp->userData);
         }
-        //执行完堆根节点的任务后，将根节点删除，然后再调整堆，迭代检查下个根节点
-        PopTimer();
-        tmp = array[0];
     }
 }
 
 /*
- * 下虑操作是迭代进行的，比如到了根节点，就会调用根节点的子节点的下虑
- * 左子结点：2*hole+1，右子节点：2*hole+2
+ * 下虑操作：hole的子结点是ARITY*hole+1到ARITY*hole+ARITY，它们在数组中相邻，
+ * 每次在其中找出超时值最小的结点，若比hole处的结点小，就把它上移一层，空穴随之下移
  */
 void TimeHeap::PercolateDown(int hole)
 {
-    //先找到以hole为头结点的那一行数组，即hole的子孙节点就在第一个结点后面
-    HeapTimeNode *tmp = array[hole];
-    int child = 0;
-    for (;((hole * 2 + 1) <= (curSize - 1)); hole = child)
-    {
-        tmp = array[hole];
-        //先处理左子节点
-        child = 2 * hole + 1;
-        //取出左右子节点之间超时值较小的结点
-        if ((child < (curSize - 1)) && (array[child + 1]->expireTimer < array[child]->expireTimer))
+    TimerNode *tmp = array[hole];
+    while (1)
+    {
+        int firstChild = ARITY * hole + 1;
+        if (firstChild >= curSize)
+        {
+            break;
+        }
+        //取出所有子节点中超时值最小的结点
+        int lastChild = (firstChild + ARITY <= curSize) ? (firstChild + ARITY) : curSize;
+        int child = firstChild;
+        for (int i = firstChild + 1; i < lastChild; i++)
         {
-            child++;
+            if (array[i]->expire < array[child]->expire)
+            {
+                child = i;
+            }
         }
-        //如果子节点的超时值小于父节点的超时值，则交换，因为都是指针，直接交换即可
-        if (array[child]->expireTimer < tmp->expireTimer) 
+        //如果子节点的超时值小于父节点的超时值，则把子结点上移，否则以hole为根的子树已经满足最小堆性质，可以直接退出
+        if (array[child]->expire < tmp->expire) 
         {
-            array[hole] = array[child];     
-            array[child] = tmp;
+            SetNode(hole, array[child]);
+            hole = child;
         }
         else
         {   
-            // 因为是从最后一个非叶子节点开始的，所以可以保证在该节点之下的节点都具备最小堆特性，如果该节点的超时小于子节点的超时，那就小于下面所有节点的超时，可以直接退出循环
             break;
         }
     }
+    SetNode(hole, tmp);
 }
 
 /*
- * 将当前的堆数组扩容1倍
+ * 上虑操作：对从空穴到根节点上的路径的所有节点执行，即本节点和父节点进行比较，父结点较大就下移一层
  */
-void TimeHeap::ResizeArray()
+void TimeHeap::PercolateUp(int hole)
 {
-    HeapTimeNode **temp = new HeapTimeNode*[2 * capacity];
-    for (int i = 0; i < 2 * capacity; i++)
+    TimerNode *tmp = array[hole];
+    while (hole > 0)
     {
-        temp[i] = NULL;
+        int parent = (hole - 1) / ARITY;
+        if (array[parent]->expire <= tmp->expire)
+        {
+            break;
+        }
+        SetNode(hole, array[parent]);
+        hole = parent;
     }
+    SetNode(hole, tmp);
+}
+
+/*
+ * 将当前的堆数组扩容1倍
+ */
+void TimeHeap::ResizeArray() throw(std::exception)
+{
+    TimerNode **temp = new TimerNode*[2 * capacity];
     if (!temp)
     {
         throw std::exception();
     }
+    for (int i = 0; i < 2 * capacity; i++)
+    {
+        temp[i] = NULL;
+    }
     for (int i = 0; i < curSize; i++)
     {
         temp[i] = array[i];
@@ -224,4 +265,47 @@ void TimeHeap::ResizeArray()
     //记得删除原数组，然后重置指针
     delete[] array;
     array = temp;
-}
\ No newline at end of file
+    capacity = 2 * capacity;
+}
+
+/*
+ * 把在绝对时间expire到期的定时器加入堆中，已经在堆中时直接调整它的位置
+ */
+void TimeHeap::AddTimer(TimerNode *timer, ClientData *userData, int64_t expire, TimerCallBack callback)
+{
+    if (!timer)
+    {
+        return;
+    }
+    timer->userData = userData;
+    timer->callback = callback;
+    /*按slack推迟到对齐的时刻，相近的定时器超时时间相同，由同一次Tick处理*/
+    expire = ApplySlack(expire, timer->slack);
+    if (timer->heapIndex >= 0)
+    {
+        AdjustTimerNode(timer, expire);
+        return;
+    }
+    timer->expire = expire;
+    AddTimerNode(timer);
+}
+
+/*
+ * 调整定时器：结点记录了自己的下标，直接在原位置上虑或下虑
+ */
+void TimeHeap::AdjustTimer(TimerNode *timer, int64_t expire)
+{
+    if (!timer)
+    {
+        return;
+    }
+    AdjustTimerNode(timer, ApplySlack(expire, timer->slack));
+}
+
+/*
+ * 从堆中删除定时器
+ */
+void TimeHeap::DeleteTimer(TimerNode *timer)
+{
+    DeleteTimerNode(timer);
+}
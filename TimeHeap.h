@@ -3,8 +3,9 @@
 > Author:        Luncles
 > 功能：          时间堆实现
 > Created Time:  Sun 28 May 2023 10:23:59 PM CST
-> Description:   对时间堆来说，删除一个定时器节点的时间复杂度是O(1)，添加一个定时器节点的时间复杂度是O(logn),
-                 执行一个定时器任务的时间复杂度是O(1)，因此，时间堆的效率很高。
+> Description:   4叉最小堆，每个结点记录自己在堆数组中的下标，因此添加、删除和调整一个定时器节点的时间
+                 复杂度都是O(logn)，被删除的结点立即离开堆数组，不会使堆膨胀；执行一个定时器任务的时间复杂度
+                 是O(logn)。4叉堆的高度只有二叉堆的一半，一个结点的4个子结点在数组中相邻，对大堆更友好。
  ************************************************************************/
 
 #ifndef MIN_HEAP
@@ -13,62 +14,52 @@
 #include <iostream>
 #include <netinet/in.h>
 #include <time.h>
-
-const int BUF_SIZE = 64;
-
-class HeapTimeNode;
-
-/*用户数据结构*/
-struct ClientData
-{
-    int clntsock;
-    struct sockaddr_in clntaddr;
-    char dataBuf[BUF_SIZE];
-    HeapTimeNode *timer;
-};
-
-/*定时器结点类*/
-class HeapTimeNode
-{
-public:
-    HeapTimeNode(int delay) { expireTimer = time(NULL) + delay; }
-
-public:
-    ClientData *userData;       //用户数据
-    time_t expireTimer;         //定时器生效的绝对时间
-    void (*CallBack)(ClientData *);     //回调函数
-};
+#include "TimerQueue.h"
 
 /*时间堆类*/
-class TimeHeap
+class TimeHeap : public TimerQueue
 {
 public:
     //构造函数一，初始化一个大小为cap的空堆。因为涉及堆，所以加了throw
     TimeHeap(int cap) throw(std::exception);
     //构造函数二，用已有数组来初始化堆
-    TimeHeap(HeapTimeNode **init_array, int size, int cap) throw(std::exception);
+    TimeHeap(TimerNode **init_array, int size, int cap) throw(std::exception);
     //析构函数
     ~TimeHeap();
     //添加目标定时器
-    void AddTimerNode(HeapTimeNode *timer) throw(std::exception);
-    //删除目标定时器
-    void DeleteTimerNode(HeapTimeNode *timer);
+    void AddTimerNode(TimerNode *timer) throw(std::exception);
+    //把目标定时器从堆中删除
+    void DeleteTimerNode(TimerNode *timer);
+    //目标定时器的超时时间改变后，调整它在堆中的位置
+    void AdjustTimerNode(TimerNode *timer, int64_t expire);
     //获得堆根节点
-    HeapTimeNode *TopTimer() const;
+    TimerNode *TopTimer() const;
     //删除堆根节点
     void PopTimer();
-    //心跳函数
-    void Tick();
+    //心跳函数：执行超时时间不晚于now的定时器
+    void TickTo(int64_t now);
+
+    /*定时器队列接口*/
+    void AddTimer(TimerNode *timer, ClientData *userData, int64_t expire, TimerCallBack callback);
+    void AdjustTimer(TimerNode *timer, int64_t expire);
+    void DeleteTimer(TimerNode *timer);
+    //堆顶就是最早到期的定时器
+    int64_t NextExpire() const { return HeapEmpty() ? -1 : array[0]->expire; }
 private:
     /*最小堆的下虑操作，确保数组中以第hole个结点为根的子树拥有最小堆性质*/
     void PercolateDown(int hole);
+    /*最小堆的上虑操作，把第hole个结点沿着到根节点的路径上移到合适位置*/
+    void PercolateUp(int hole);
+    /*把结点放到堆数组的第hole个位置，并更新它记录的下标*/
+    void SetNode(int hole, TimerNode *timer) { array[hole] = timer; timer->heapIndex = hole; }
     /*将当前的堆数组扩容一倍*/
     void ResizeArray() throw(std::exception);
     /*判断当前堆数组是否为空*/
     bool HeapEmpty() const { return curSize == 0; }
 
 private:
-    HeapTimeNode **array;          //堆数组
+    static const int ARITY = 4;     //每个结点的子结点数
+    TimerNode **array;             //堆数组，元素指向调用者提供的结点
     int capacity;               //堆数组的容量
     int curSize;                //堆数组当前包含元素的个数
 };
@@ -1,210 +1,408 @@
 /* ************************************************************************
 > File Name:     TimeWheelTimer.h
 > Author:        Luncles
-> 功能：          简易时间轮实现代码
+> 功能：          分层时间轮实现代码
 > Created Time:  Sat 27 May 2023 10:10:47 PM CST
-> Description:   
+> Description:   毫秒级的分层（hashed hierarchical）时间轮，与Linux内核定时器的组织方式相同：
+                 第0层有256个槽，每个槽代表一个滴答（默认1毫秒）；第1~3层各有64个槽，每个槽分别代表
+                 2^8、2^14、2^20个滴答，四层一共覆盖2^26个滴答（1毫秒滴答时约18.6小时），更远的定时器
+                 暂放在第3层最远的槽中，级联时再按真实超时时间重新放置。
+                 添加和删除定时器都是O(1)的；第0层转完一圈时，把上一层对应槽中的定时器级联到下层。
+                 每层用位图记录哪些槽非空，心跳时直接跳过空槽和空的级联点，所以心跳的开销只与到期的
+                 定时器和非空的级联槽有关，与经过的滴答数无关。
  ************************************************************************/
 
 #ifndef TIME_WHEEL_TIMER
 #define TIME_WHEEL_TIMER
 
-#include <time.h>
+#include <stdint.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <stdio.h>
+#include "TimerQueue.h"
 
-const int BUF_SIZE = 64;
+/*时间轮类*/
+class TimeWheel : public TimerQueue
+{
+public:
+    /*tickMs是第0层每个槽代表的毫秒数，即时间轮的精度*/
+    TimeWheel(int tickMs = 1);
+    ~TimeWheel(); 
+    //添加在绝对时间expire到期的定时器
+    void AddTimer(TimerNode *timer, ClientData *userData, int64_t expire, TimerCallBack callback);
+    //修改定时器的超时时间，把它移动到新的槽中
+    void AdjustTimer(TimerNode *timer, int64_t expire);
+    //删除定时器
+    void DeleteTimer(TimerNode *timer);
+    //把时间轮转动到时刻now，执行其间到期的任务
+    void TickTo(int64_t now);
+    //下一个非空的第0层槽或下一个非空的级联点，取较早者
+    int64_t NextExpire() const;
 
-class TimeWheelTimer;
+private:
+    //按定时器的超时时间计算它所在的层和槽，并把它插入槽中，cascade表示是在级联中重新插入
+    void InsertTimer(TimerNode *timer, bool cascade = false);
+    //把定时器从它所在的槽中摘下
+    void RemoveTimer(TimerNode *timer);
+    //执行第0层第slot个槽上的所有定时任务
+    void ExpireSlot(int slot);
+    //在滴答curTick处把上层对应槽中的定时器级联到下层
+    void Cascade();
+    //第0层之上下一个非空槽的级联时刻（滴答），没有时返回UINT64_MAX
+    uint64_t NextCascadeTick() const;
+    //在第level层的位图中找[from, to]内第一个非空的槽，没有时返回-1
+    int FindSlot(int level, int from, int to) const;
+    //第level层第slot个槽是否非空
+    void MarkSlot(int level, int slot, bool used);
+    //第0层是否为空
+    bool RootEmpty() const;
 
-/*用户数据结构*/
-struct ClientData
-{
-    int clntsock;
-    struct sockaddr_in clntAddr;
-    char buf[BUF_SIZE];
-    TimeWheelTimer *clntTimer;
+private:
+    static const int LEVEL_NUM = 4;             //时间轮的层数
+    static const int ROOT_BITS = 8;
+    static const int ROOT_SLOTS = 1 << ROOT_BITS;   //第0层的槽数
+    static const int LEVEL_BITS = 6;
+    static const int LEVEL_SLOTS = 1 << LEVEL_BITS; //第1~3层的槽数
+    static const uint64_t MAX_TICKS = (uint64_t)1 << (ROOT_BITS + (LEVEL_NUM - 1) * LEVEL_BITS);   //时间轮能表示的最大滴答数
+
+    int64_t tickMs;                     //每个滴答的毫秒数
+    uint64_t curTick;                   //已经处理到的滴答，超时时间不晚于它的定时器都已执行
+    int timerNum;                       //时间轮上定时器的数目
+    TimerNode *slots[LEVEL_NUM][ROOT_SLOTS];       //每个槽指向一个定时器链表，链表无序。第1~3层只用前64个槽
+    uint64_t bitmap[LEVEL_NUM][ROOT_SLOTS / 64];        //每层非空槽的位图
 };
 
-/*定时器类*/
-class TimeWheelTimer
+/*
+ * 第level层每个槽代表的滴答数的对数
+ */
+static inline int LevelShift(int level)
 {
-public:
-    TimeWheelTimer(int rotaNum, int ts) : prev(nullptr), next(nullptr), rotationNum(rotaNum), timeSlot(ts) { }
-    ~TimeWheelTimer();
+    return level == 0 ? 0 : 8 + (level - 1) * 6;
+}
 
-public:
-    TimeWheelTimer *prev;           //指向下一个定时器
-    TimeWheelTimer *next;           //指向前一个定时器
-    int rotationNum;                //记录定时器在时间轮转多少圈后生效
-    int timeSlot;                   //记录定时器属于时间轮上哪个槽
-    ClientData *userData;           //保存用户数据
-    void (*CallBack)(ClientData *); //定时器回调函数
-};
+TimeWheel::TimeWheel(int tickMs) : tickMs(tickMs > 0 ? tickMs : 1), timerNum(0)
+{
+    curTick = GetCurrentMs() / this->tickMs;
+    memset(slots, 0, sizeof(slots));                //初始化每个槽的头结点
+    memset(bitmap, 0, sizeof(bitmap));
+}
 
-/*时间轮类*/
-class TimeWheel
+TimeWheel::~TimeWheel()
 {
-public:
-    TimeWheel() : curSlot(0)
+    for (int level = 0; level < LEVEL_NUM; level++)
     {
-        for (int i = 0; i < numSlot; i++)
+        for (int i = 0; i < ROOT_SLOTS; i++)
         {
-            slots[i] = nullptr;             //初始化每个槽的头结点
+            /*结点的内存属于调用者，这里只把它们摘下*/
+            while (slots[level][i])
+            {
+                RemoveTimer(slots[level][i]);
+            }
         }
     }
-    ~TimeWheel(); 
-    //根据定时值创建定时器，并插入槽中
-    TimeWheelTimer *AddTimer(int timeout);
-    //删除定时器
-    void DeleteTimer(TimeWheelTimer *timer);
-    //心跳函数
-    void Tick();
+}
 
-private:
-    int curSlot;                        //时间轮的当前槽
-    static const int numSlot = 60;      //时间轮上槽的数目
-    static const int rotateTime = 1;    //每隔1秒时间轮转动一次
-    TimeWheelTimer *slots[numSlot];     //时间轮的槽，每个槽指向一个定时器链表，链表无序
-};
+/*
+ * 把在绝对时间expire到期的定时器插入到合适的槽中
+ */
+void TimeWheel::AddTimer(TimerNode *timer, ClientData *userData, int64_t expire, TimerCallBack callback)
+{
+    if (!timer)
+    {
+        return;
+    }
+    timer->userData = userData;
+    timer->callback = callback;
+    if (timer->pending)
+    {
+        RemoveTimer(timer);
+    }
+    timer->expire = ApplySlack(expire, timer->slack);
+    InsertTimer(timer);
+}
 
-TimeWheel::~TimeWheel()
+/*
+ * 修改定时器的超时时间：从原来的槽中摘下，再按新的超时值插入
+ */
+void TimeWheel::AdjustTimer(TimerNode *timer, int64_t expire)
 {
-    for (int i = 0; i < numSlot; i++)
+    if (!timer || !timer->pending)
     {
-        TimeWheelTimer *tmp = slots[i];
-        while (tmp)
-        {
-            slots[i] = tmp->next;
-            delete tmp;
-            tmp = slots[i];
-        }
+        return;
     }
+    RemoveTimer(timer);
+    timer->expire = ApplySlack(expire, timer->slack);
+    InsertTimer(timer);
 }
 
 /*
- * 根据定时值timeout创建一个定时器，并将其插入到合适的槽中
+ * 删除目标定时器
  */
-TimeWheelTimer * TimeWheel::AddTimer(int timeout)
+void TimeWheel::DeleteTimer(TimerNode *timer)
 {
-    if (timeout < 0)
+    if (!timer || !timer->pending)
     {
-        return nullptr;
+        return;
     }
+    RemoveTimer(timer);
+}
 
-    int ticks = 0;
-    /*下面根据timeout算出该定时器在时间轮转动多少个槽后会被触发，并将该滴答数存储在变量ticks中，如果待插入定时器的
-    超时值小于时间轮的槽间隔rotateTime，那么将ticks向上取整为1，如果大于槽间隔，就向下取整为timeout/rotateTime*/
-    if (timeout <= rotateTime)
+/*
+ * 计算定时器应放在哪一层的哪个槽：到期滴答数距当前滴答越远，放在越高的层。
+ * 槽号直接取到期滴答数的对应位，因此第0层之上的槽在下层转完一圈、该位对应的槽被轮到时级联下来
+ */
+void TimeWheel::InsertTimer(TimerNode *timer, bool cascade)
+{
+    /*超时时间向上取整到滴答，保证定时器不会提前触发；已经过期的定时器在下一个滴答触发。
+    级联发生在第0层的0号槽被处理之前，所以恰好在当前滴答到期的定时器可以放进当前槽*/
+    int64_t expireTick = (timer->expire + tickMs - 1) / tickMs;
+    uint64_t minTick = cascade ? curTick : curTick + 1;
+    uint64_t tick = (expireTick > (int64_t)minTick) ? (uint64_t)expireTick : minTick;
+    uint64_t ticks = tick - curTick;
+    if (ticks >= MAX_TICKS)
     {
-        ticks = 1;
+        /*超出时间轮的范围，先放在最远的槽里，级联时会按真实超时时间重新放置*/
+        tick = curTick + MAX_TICKS - 1;
+        ticks = MAX_TICKS - 1;
     }
-    else
+
+    int level = 0;
+    while ((level < LEVEL_NUM - 1) && (ticks >= ((uint64_t)1 << LevelShift(level + 1))))
     {
-        ticks = timeout / rotateTime;
+        level++;
     }
+    int insertSlot = (level == 0) ? (int)(tick & (ROOT_SLOTS - 1)) : (int)((tick >> LevelShift(level)) & (LEVEL_SLOTS - 1));
 
-    /*根据超时时间计算时间轮转动多少圈后会被触发*/
-    int rotation = ticks / numSlot;
-    /*计算待插入的定时器应被插在哪个槽里*/
-    int insertSlot = (curSlot + ticks % numSlot) % numSlot;
-    /*创建新的定时器，在时间轮转动rotation圈后被触发，且位于第insertSlot个槽上*/
-    TimeWheelTimer *timer  = new TimeWheelTimer(rotation, insertSlot);
+    timer->level = (int16_t)level;
+    timer->timeSlot = (int16_t)insertSlot;
+    timer->prev = nullptr;
+    /*头插法*/
+    timer->next = slots[level][insertSlot];
+    if (timer->next)
+    {
+        timer->next->prev = timer;
+    }
+    slots[level][insertSlot] = timer;
+    MarkSlot(level, insertSlot, true);
+    timer->pending = true;
+    timerNum++;
+}
 
-    /*如果第insertSlot个槽上没有任何定时器，就将新建的定时器插入其中，并将该定时器设置为该槽的头结点*/
-    if (!slots[insertSlot])
+/*
+ * 把目标定时器从它所在的槽中摘下
+ */
+void TimeWheel::RemoveTimer(TimerNode *timer)
+{
+    int level = timer->level;
+    int targetSlot = timer->timeSlot;
+    /*slots[level][targetSlot]就是目标定时器所在的槽的头结点。如果目标定时器就是该头结点，则需要重置头结点*/
+    if (timer == slots[level][targetSlot])
     {
-        printf("add timer, rotation is %d, insertslot is %d, curSlot is %d\n", rotation, insertSlot, curSlot);
-        slots[insertSlot] = timer;
+        slots[level][targetSlot] = timer->next;
     }
-    /*否则，将定时器插入到第insertSlot个槽中*/
     else
     {
-        /*头插法*/
-        timer->next = slots[insertSlot];
-        slots[insertSlot]->prev = timer;
-        slots[insertSlot] = timer;
+        timer->prev->next = timer->next;
     }
-    return timer;
+    if (timer->next)
+    {
+        timer->next->prev = timer->prev;
+    }
+    if (!slots[level][targetSlot])
+    {
+        MarkSlot(level, targetSlot, false);
+    }
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    timer->pending = false;
+    timerNum--;
 }
 
 /*
- * 删除目标定时器
+ * 把时间轮转动到时刻now。第0层在一圈之内只访问非空的槽；转完一圈时，如果第0层已经空了，
+ * 就直接跳到下一个非空的级联点，中间的空滴答完全不访问
  */
-void TimeWheel::DeleteTimer(TimeWheelTimer *timer)
+void TimeWheel::TickTo(int64_t now)
 {
-    if (!timer)
+    uint64_t target = now / tickMs;
+    while (curTick < target)
     {
-        return;
+        /*先处理第0层本圈内(curTick, stop]之间的非空槽*/
+        uint64_t lapEnd = curTick | (ROOT_SLOTS - 1);
+        uint64_t stop = (target < lapEnd) ? target : lapEnd;
+        int slot;
+        while ((curTick < stop) && ((slot = FindSlot(0, (int)(curTick & (ROOT_SLOTS - 1)) + 1, (int)(stop & (ROOT_SLOTS - 1)))) >= 0))
+        {
+            curTick = (curTick & ~(uint64_t)(ROOT_SLOTS - 1)) | slot;
+            ExpireSlot(slot);
+        }
+        curTick = stop;
+        if (curTick == target)
+        {
+            break;
+        }
+
+        /*然后转过本圈的边界：第0层还有定时器时必须在边界处级联，否则跳到下一个非空的级联点*/
+        uint64_t next = RootEmpty() ? NextCascadeTick() : lapEnd + 1;
+        if (next > target)
+        {
+            curTick = target;
+            break;
+        }
+        curTick = next;
+        Cascade();
+        ExpireSlot(0);
     }
-    int targetSlot = timer->timeSlot;
-    /*slots[targetSlot]就是目标定时器所在的槽的头结点。如果目标定时器就是该头结点，则需要重置头结点*/
-    if (timer == slots[targetSlot])
+}
+
+/*
+ * 执行第0层第slot个槽上的定时任务：每次先摘下一个定时器再执行回调，回调中可以安全地增删定时器
+ */
+void TimeWheel::ExpireSlot(int slot)
+{
+    TimerNode *tmp;
+    while ((tmp = slots[0][slot]) != nullptr)
     {
-        slots[targetSlot] = slots[targetSlot]->next;
-        if (slots[targetSlot])
+        RemoveTimer(tmp);
+        if (tmp->callback)
         {
-            slots[targetSlot]->prev = nullptr;
+            tmp->callback(tmp->userData);
         }
-        delete timer;
     }
-    else
+}
+
+/*
+ * 第0层转完一圈时，把第1层当前槽中的定时器重新插入（它们都会落到下层）；
+ * 如果第1层也恰好转完一圈，就继续级联第2层，依此类推
+ */
+void TimeWheel::Cascade()
+{
+    for (int level = 1; level < LEVEL_NUM; level++)
     {
-        timer->prev->next = timer->next;
-        if (timer->next)
+        int slot = (int)((curTick >> LevelShift(level)) & (LEVEL_SLOTS - 1));
+        TimerNode *tmp = slots[level][slot];
+        slots[level][slot] = nullptr;
+        MarkSlot(level, slot, false);
+        while (tmp)
         {
-            timer->next->prev = timer->prev;
+            TimerNode *next = tmp->next;
+            timerNum--;
+            InsertTimer(tmp, true);
+            tmp = next;
+        }
+        if (slot != 0)
+        {
+            break;
         }
-        delete timer;
     }
 }
 
 /*
- * 当一个心跳时间rotateTime到后，调用该函数，执行当前槽上到期的任务，然后时间轮向前滚动一个槽的间隔
+ * 各层中当前槽之后第一个非空槽被级联的时刻，取最早者
  */
-void TimeWheel::Tick()
+uint64_t TimeWheel::NextCascadeTick() const
 {
-    TimeWheelTimer *tmp = slots[curSlot];   //取得时间轮上当前槽的头结点
-    printf("current slot is %d\n", curSlot);
-    while (tmp)
+    uint64_t next = UINT64_MAX;
+    for (int level = 1; level < LEVEL_NUM; level++)
     {
-        printf("tick the timer once\n");
-        /*如果定时器的rotationNum值大于0，则当前结点的任务在这一圈还没到期，不用触发*/
-        if (tmp->rotationNum > 0)
+        int shift = LevelShift(level);
+        uint64_t cur = curTick >> shift;
+        int curSlot = (int)(cur & (LEVEL_SLOTS - 1));
+        /*从当前槽的下一个槽开始环形查找，当前槽本身要再转一整圈才会被级联*/
+        int slot = FindSlot(level, curSlot + 1, LEVEL_SLOTS - 1);
+        uint64_t dist = 0;
+        if (slot >= 0)
         {
-            tmp->rotationNum--;
-            tmp = tmp->next;
+            dist = slot - curSlot;
+        }
+        else if ((slot = FindSlot(level, 0, curSlot)) >= 0)
+        {
+            dist = slot + LEVEL_SLOTS - curSlot;
         }
-        /*如果rotationNum=0，说明该结点的任务在这一圈就会被触发，于是执行定时任务，然后删除该定时器*/
         else
         {
-            tmp->CallBack(tmp->userData);
-            if (tmp == slots[curSlot])
-            {
-                printf("delete header in curSlot\n");
-                slots[curSlot] = slots[curSlot]->next;
-                delete tmp;
-                if (slots[curSlot])
-                {
-                    slots[curSlot]->prev = nullptr;
-                }
-                tmp = slots[curSlot];
-            }
-            else
-            {
-                tmp->prev->next = tmp->next;
-                if (tmp->next)
-                {
-                    tmp->next->prev = tmp->prev;
-                }
-                TimeWheelTimer *tmp2 = tmp->next;
-                delete tmp;
-                tmp = tmp2;
-            }
+            continue;
+        }
+        uint64_t tick = (cur + dist) << shift;
+        if (tick < next)
+        {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+/*
+ * 最近一个需要心跳的时刻：第0层下一个非空槽是精确的到期时刻，级联点则是保守的唤醒时刻
+ */
+int64_t TimeWheel::NextExpire() const
+{
+    if (timerNum == 0)
+    {
+        return -1;
+    }
+    uint64_t next = NextCascadeTick();
+    int curSlot = (int)(curTick & (ROOT_SLOTS - 1));
+    int slot = FindSlot(0, curSlot + 1, ROOT_SLOTS - 1);
+    uint64_t rootNext = UINT64_MAX;
+    if (slot >= 0)
+    {
+        rootNext = curTick + (slot - curSlot);
+    }
+    else if ((slot = FindSlot(0, 0, curSlot)) >= 0)
+    {
+        rootNext = curTick + (slot + ROOT_SLOTS - curSlot);
+    }
+    if (rootNext < next)
+    {
+        next = rootNext;
+    }
+    return (int64_t)next * tickMs;
+}
+
+int TimeWheel::FindSlot(int level, int from, int to) const
+{
+    for (int word = from / 64; (from <= to) && (word <= to / 64); word++)
+    {
+        uint64_t bits = bitmap[level][word];
+        if (word == from / 64)
+        {
+            bits &= ~(uint64_t)0 << (from % 64);
+        }
+        if (word == to / 64)
+        {
+            bits &= ~(uint64_t)0 >> (63 - to % 64);
+        }
+        if (bits)
+        {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
+}
+
+void TimeWheel::MarkSlot(int level, int slot, bool used)
+{
+    if (used)
+    {
+        bitmap[level][slot / 64] |= (uint64_t)1 << (slot % 64);
+    }
+    else
+    {
+        bitmap[level][slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    }
+}
+
+bool TimeWheel::RootEmpty() const
+{
+    for (int word = 0; word < ROOT_SLOTS / 64; word++)
+    {
+        if (bitmap[0][word])
+        {
+            return false;
         }
     }
-    /*执行完当前周期所有到期的任务之后，就转动时间轮到下一个槽*/
-    curSlot = (curSlot + 1) % numSlot;
+    return true;
 }
 
-#endif
\ No newline at end of file
+#endif
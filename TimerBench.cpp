@@ -0,0 +1,454 @@
+/* ************************************************************************
+> File Name:     TimerBench.cpp
+> Author:        Luncles
+> 功能：          升序链表、时间轮和时间堆三种定时器的微基准测试和等价性检查
+> Created Time:  Wed 21 Oct 2026 09:40:12 AM CST
+> Description:   用TickTo驱动虚拟时间，不依赖真实时钟，结果可以重复。对每种定时器、每个规模和每种超时分布
+                 分别测量添加、调整、删除和心跳（逐毫秒推进直到全部到期）的每次操作耗时，每个定时器占用的内存
+                 （结点本身加上队列额外分配的内存），以及perf_event统计的缓存未命中数（不可用时显示为-）。
+                 超时分布有两种：keepalive是10~20秒的均匀分布；bimodal是90%的100~1000毫秒请求超时加10%的
+                 30~60秒空闲超时。等价性检查用同一个随机操作序列（包括在回调中重新添加定时器）驱动所有定时器，
+                 比较每个定时器到期的时刻是否完全相同。
+                 -S给每个定时器设置合并窗口slack（毫秒），心跳阶段统计有定时器到期的Tick数，即按最近到期时刻
+                 设定timerfd的事件循环实际被唤醒的次数，以及到期期间平均每秒的唤醒次数。
+                 编译：g++ -std=c++11 -O2 -o TimerBench TimerBench.cpp TimerQueue.cpp TimeHeap.cpp
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TimerQueue.h"
+#include "Histogram.h"
+
+/*超时分布*/
+enum Distribution { DIST_KEEPALIVE, DIST_BIMODAL };
+static const char *distNames[] = { "keepalive", "bimodal" };
+
+/*按分布生成一个相对超时时间（毫秒）*/
+int64_t SampleTimeout(Distribution dist, std::mt19937_64 &rng)
+{
+    if (dist == DIST_KEEPALIVE)
+    {
+        return 10000 + (int64_t)(rng() % 10000);
+    }
+    if (rng() % 10 != 0)
+    {
+        return 100 + (int64_t)(rng() % 900);
+    }
+    return 30000 + (int64_t)(rng() % 30000);
+}
+
+/*
+ * 缓存未命中计数器：perf_event_open打开失败（内核不支持或没有权限）时所有读数都是-1
+ */
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~CacheMissCounter() { if (fd >= 0) close(fd); }
+    bool Available() const { return fd >= 0; }
+    void Start()
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    /*停止计数并返回Start以来的未命中数*/
+    int64_t Stop()
+    {
+        if (fd < 0)
+        {
+            return -1;
+        }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        int64_t count = 0;
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+        {
+            return -1;
+        }
+        return count;
+    }
+
+private:
+    int fd;
+};
+
+static CacheMissCounter cacheMisses;
+
+/*一个阶段的测量结果*/
+struct PhaseResult
+{
+    double nsPerOp;
+    double missesPerOp;     //没有计数器时为负数
+};
+
+/*到期回调只计数，避免回调本身的开销淹没定时器的开销*/
+static uint64_t firedNum = 0;
+void CountCallBack(ClientData *)
+{
+    firedNum++;
+}
+
+/*每个定时器的合并窗口（毫秒），0表示准时到期*/
+static int32_t timerSlack = 0;
+
+/*当前已分配的堆内存字节数*/
+size_t HeapBytes()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+void PrintPhase(const char *name, const PhaseResult &result)
+{
+    if (result.missesPerOp >= 0)
+    {
+        printf("  %-7s %9.1f ns/op %9.2f misses/op", name, result.nsPerOp, result.missesPerOp);
+    }
+    else
+    {
+        printf("  %-7s %9.1f ns/op %9s misses/op", name, result.nsPerOp, "-");
+    }
+}
+
+/*
+ * 对一种定时器、一个规模和一种分布依次测量：添加N个定时器、随机调整、删除一半再加回、逐毫秒推进到全部到期
+ */
+void RunWorkload(const char *engine, int timerNum, Distribution dist, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<ClientData> users(timerNum);
+    std::vector<int> order(timerNum);
+    for (int i = 0; i < timerNum; i++)
+    {
+        users[i].clntsock = i;
+        users[i].timer.slack = timerSlack;
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    /*调整的次数不少于10万次，让小规模的测量也足够稳定*/
+    int adjustNum = std::max(timerNum, 100000);
+    std::vector<std::pair<int, int64_t>> adjusts(adjustNum);
+    for (int i = 0; i < adjustNum; i++)
+    {
+        adjusts[i] = std::make_pair((int)(rng() % timerNum), SampleTimeout(dist, rng));
+    }
+    std::vector<int64_t> timeouts(timerNum);
+    for (int i = 0; i < timerNum; i++)
+    {
+        timeouts[i] = SampleTimeout(dist, rng);
+    }
+
+    size_t heapBefore = HeapBytes();
+    TimerQueue *queue = CreateTimerQueue(engine);
+    int64_t now = GetCurrentMs();
+    PhaseResult add, adjust, cancel, tick;
+
+    /*添加*/
+    cacheMisses.Start();
+    uint64_t begin = NowNs();
+    for (int i = 0; i < timerNum; i++)
+    {
+        queue->AddTimer(&users[i].timer, &users[i], now + timeouts[i], CountCallBack);
+    }
+    add.nsPerOp = (double)(NowNs() - begin) / timerNum;
+    add.missesPerOp = (double)cacheMisses.Stop() / timerNum;
+    double bytesPerTimer = sizeof(TimerNode) + (double)(HeapBytes() - heapBefore) / timerNum;
+
+    /*调整：每次把一个随机的定时器推迟到新的超时时间，像收到数据的连接那样*/
+    cacheMisses.Start();
+    begin = NowNs();
+    for (int i = 0; i < adjustNum; i++)
+    {
+        queue->AdjustTimer(&users[adjusts[i].first].timer, now + adjusts[i].second);
+    }
+    adjust.nsPerOp = (double)(NowNs() - begin) / adjustNum;
+    adjust.missesPerOp = (double)cacheMisses.Stop() / adjustNum;
+
+    /*删除：按随机顺序删除一半，之后原样加回，给心跳阶段使用*/
+    int cancelNum = timerNum / 2;
+    cacheMisses.Start();
+    begin = NowNs();
+    for (int i = 0; i < cancelNum; i++)
+    {
+        queue->DeleteTimer(&users[order[i]].timer);
+    }
+    cancel.nsPerOp = (double)(NowNs() - begin) / cancelNum;
+    cancel.missesPerOp = (double)cacheMisses.Stop() / cancelNum;
+    for (int i = 0; i < cancelNum; i++)
+    {
+        queue->AddTimer(&users[order[i]].timer, &users[order[i]], now + timeouts[order[i]], CountCallBack);
+    }
+
+    /*心跳：每次推进1毫秒，直到所有定时器到期，按到期的定时器数平摊。
+     *有定时器到期的Tick就是事件循环被timerfd唤醒的次数，记下第一次和最后一次唤醒的时刻算唤醒的频率*/
+    firedNum = 0;
+    uint64_t tickCalls = 0;
+    uint64_t wakeups = 0;
+    int64_t firstWakeup = 0;
+    int64_t lastWakeup = 0;
+    cacheMisses.Start();
+    begin = NowNs();
+    while (queue->NextExpire() >= 0)
+    {
+        uint64_t firedBefore = firedNum;
+        queue->TickTo(++now);
+        tickCalls++;
+        if (firedNum != firedBefore)
+        {
+            firstWakeup = wakeups ? firstWakeup : now;
+            lastWakeup = now;
+            wakeups++;
+        }
+    }
+    uint64_t tickNs = NowNs() - begin;
+    tick.nsPerOp = (double)tickNs / (firedNum ? firedNum : 1);
+    tick.missesPerOp = (double)cacheMisses.Stop() / (firedNum ? firedNum : 1);
+
+    printf("%-5s %-9s N=%-8d %6.1f B/timer\n", engine, distNames[dist], timerNum, bytesPerTimer);
+    PrintPhase("add", add);
+    PrintPhase("adjust", adjust);
+    printf("\n");
+    PrintPhase("cancel", cancel);
+    PrintPhase("tick", tick);
+    printf("  (%llu fired, %llu ticks, %.1f ns/tick, %llu wakeups, %.1f wakeups/s, slack %lld ms)\n",
+        (unsigned long long)firedNum, (unsigned long long)tickCalls, (double)tickNs / (tickCalls ? tickCalls : 1),
+        (unsigned long long)wakeups, (double)wakeups * 1000 / ((lastWakeup > firstWakeup) ? lastWakeup - firstWakeup : 1),
+        (long long)timerSlack);
+    if (firedNum != (uint64_t)timerNum)
+    {
+        printf("  ERROR: %d timers added but %llu fired\n", timerNum, (unsigned long long)firedNum);
+    }
+    delete queue;
+}
+
+/*等价性检查的状态：回调通过clntsock找到定时器编号，记录到期时刻，部分定时器在回调中重新添加*/
+static TimerQueue *checkQueue = nullptr;
+static std::vector<std::pair<int64_t, int>> *fireLog = nullptr;
+static int64_t checkNow = 0;
+static int64_t checkStart = 0;
+static bool checkReAdd = true;
+
+void CheckCallBack(ClientData *user)
+{
+    fireLog->push_back(std::make_pair(checkNow - checkStart, user->clntsock));
+    /*每7个定时器中有一个在回调中重新添加，超时时间由编号和相对时刻决定，与定时器的实现无关*/
+    if (checkReAdd && (user->clntsock % 7 == 0))
+    {
+        checkQueue->AddTimer(&user->timer, user, checkNow + 1 + (user->clntsock + checkNow - checkStart) % 500, CheckCallBack);
+    }
+}
+
+/*
+ * 用seed决定的随机操作序列从start时刻开始驱动一种定时器，返回按(相对到期时刻, 编号)排序的到期记录。
+ * 合并后的到期时刻与绝对时间有关，所有定时器要从同一个start开始
+ */
+std::vector<std::pair<int64_t, int>> RunScript(const char *engine, int timerNum, int steps, uint64_t seed, int64_t start)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<ClientData> users(timerNum);
+    std::vector<std::pair<int64_t, int>> log;
+    for (int i = 0; i < timerNum; i++)
+    {
+        users[i].clntsock = i;
+        /*一半定时器准时到期，一半按-S合并*/
+        users[i].timer.slack = (i % 2) ? timerSlack : 0;
+    }
+    checkQueue = CreateTimerQueue(engine);
+    checkReAdd = true;
+    fireLog = &log;
+    checkNow = checkStart = start;
+    for (int step = 0; step < steps; step++)
+    {
+        /*每毫秒做若干次随机操作：添加（超时时间可能已经过去）、调整或删除*/
+        int ops = (int)(rng() % 16);
+        for (int k = 0; k < ops; k++)
+        {
+            ClientData *user = &users[rng() % timerNum];
+            int op = (int)(rng() % 10);
+            Distribution dist = (rng() % 2) ? DIST_KEEPALIVE : DIST_BIMODAL;
+            int64_t expire = checkNow - 5 + (int64_t)(rng() % 20);
+            if (rng() % 4 == 0)
+            {
+                expire = checkNow + SampleTimeout(dist, rng) / 20;
+            }
+            if (op < 5)
+            {
+                checkQueue->AddTimer(&user->timer, user, expire, CheckCallBack);
+            }
+            else if (op < 8)
+            {
+                checkQueue->AdjustTimer(&user->timer, expire);
+            }
+            else
+            {
+                checkQueue->DeleteTimer(&user->timer);
+            }
+        }
+        checkQueue->TickTo(++checkNow);
+    }
+    /*最后把剩下的定时器全部推进到期，回调中不再重新添加*/
+    checkReAdd = false;
+    while (checkQueue->NextExpire() >= 0)
+    {
+        checkQueue->TickTo(++checkNow);
+    }
+    delete checkQueue;
+    checkQueue = nullptr;
+    std::sort(log.begin(), log.end());
+    return log;
+}
+
+/*
+ * 比较各定时器的到期记录：同一个定时器必须在同一个毫秒到期，同一毫秒内的先后顺序不作要求
+ */
+bool CheckEquivalence(const std::vector<std::string> &engines, int timerNum, int steps, uint64_t seed)
+{
+    int64_t start = GetCurrentMs();
+    std::vector<std::pair<int64_t, int>> expected = RunScript(engines[0].c_str(), timerNum, steps, seed, start);
+    bool same = true;
+    for (size_t e = 1; e < engines.size(); e++)
+    {
+        std::vector<std::pair<int64_t, int>> log = RunScript(engines[e].c_str(), timerNum, steps, seed, start);
+        size_t diff = 0;
+        while ((diff < log.size()) && (diff < expected.size()) &&
+            (log[diff] == expected[diff]))
+        {
+            diff++;
+        }
+        if ((diff != log.size()) || (diff != expected.size()))
+        {
+            same = false;
+            printf("check %-5s differs from %s at record %zu of %zu/%zu\n", engines[e].c_str(), engines[0].c_str(),
+                diff, log.size(), expected.size());
+        }
+    }
+    if (same)
+    {
+        printf("check %d timers, %d ms of random add/adjust/delete: ", timerNum, steps);
+        for (size_t e = 0; e < engines.size(); e++)
+        {
+            printf("%s%s", (e == 0) ? "" : ", ", engines[e].c_str());
+        }
+        printf(" fired the same %zu timers at the same times\n", expected.size());
+    }
+    return same;
+}
+
+/*把逗号分隔的列表拆开*/
+std::vector<std::string> SplitList(const char *text)
+{
+    std::vector<std::string> items;
+    std::string item;
+    for (const char *p = text; ; p++)
+    {
+        if ((*p == ',') || (*p == '\0'))
+        {
+            if (!item.empty())
+            {
+                items.push_back(item);
+            }
+            item.clear();
+            if (*p == '\0')
+            {
+                break;
+            }
+        }
+        else
+        {
+            item += *p;
+        }
+    }
+    return items;
+}
+
+void Usage(const char *name)
+{
+    printf("Usage : %s [-e list,wheel,heap] [-n 1000,10000,100000,1000000] [-d keepalive,bimodal] [-L listMax] [-s seed] [-S slackMs]\n"
+           "        -L: the sorted list is O(n) per operation, sizes above listMax (default 10000) are skipped for it\n"
+           "        -S: every timer may fire up to slackMs late so that nearby expirations share one wakeup (default 0)\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> engines = SplitList("list,wheel,heap");
+    std::vector<std::string> sizes = SplitList("1000,10000,100000,1000000");
+    std::vector<std::string> dists = SplitList("keepalive,bimodal");
+    int listMax = 10000;
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:n:d:L:s:S:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'e': engines = SplitList(optarg); break;
+            case 'n': sizes = SplitList(optarg); break;
+            case 'd': dists = SplitList(optarg); break;
+            case 'L': listMax = atoi(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 'S': timerSlack = atoi(optarg); break;
+            default: Usage(argv[0]);
+        }
+    }
+    for (size_t e = 0; e < engines.size(); e++)
+    {
+        TimerQueue *queue = CreateTimerQueue(engines[e].c_str());
+        if (!queue)
+        {
+            Usage(argv[0]);
+        }
+        delete queue;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("sizeof(TimerNode)=%zu, cache-miss counter %s\n", sizeof(TimerNode),
+        cacheMisses.Available() ? "available" : "unavailable (perf_event_open failed)");
+    bool same = CheckEquivalence(engines, 2000, 20000, seed);
+
+    for (size_t d = 0; d < dists.size(); d++)
+    {
+        Distribution dist = (dists[d] == "bimodal") ? DIST_BIMODAL : DIST_KEEPALIVE;
+        for (size_t n = 0; n < sizes.size(); n++)
+        {
+            int timerNum = atoi(sizes[n].c_str());
+            for (size_t e = 0; e < engines.size(); e++)
+            {
+                if ((engines[e] == "list") && (timerNum > listMax))
+                {
+                    printf("%-5s %-9s N=%-8d skipped (above -L %d)\n", "list", distNames[dist], timerNum, listMax);
+                    continue;
+                }
+                if (timerNum > 0)
+                {
+                    RunWorkload(engines[e].c_str(), timerNum, dist, seed + n);
+                }
+            }
+        }
+    }
+    return same ? 0 : 1;
+}
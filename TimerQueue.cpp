@@ -0,0 +1,33 @@
+/* ************************************************************************
+> File Name:     TimerQueue.cpp
+> Author:        Luncles
+> 功能：          按名字创建定时器队列
+> Created Time:  Sat 17 Oct 2026 02:31:16 PM CST
+> Description:   升序链表和时间轮的实现都在头文件中，只在这里包含一次
+ ************************************************************************/
+
+#include <string.h>
+#include "TimerQueue.h"
+#include "AscendingListTimer.h"
+#include "TimeWheelTimer.h"
+#include "TimeHeap.h"
+
+/*时间堆的初始容量，满了会自动扩容*/
+const int HEAP_INIT_CAPACITY = 64;
+
+TimerQueue *CreateTimerQueue(const char *name)
+{
+    if (strcmp(name, "list") == 0)
+    {
+        return new SortListTimer();
+    }
+    else if (strcmp(name, "wheel") == 0)
+    {
+        return new TimeWheel();
+    }
+    else if (strcmp(name, "heap") == 0)
+    {
+        return new TimeHeap(HEAP_INIT_CAPACITY);
+    }
+    return nullptr;
+}
@@ -0,0 +1,116 @@
+/* ************************************************************************
+> File Name:     TimerQueue.h
+> Author:        Luncles
+> 功能：          定时器队列的公共接口，以及各定时器共用的用户数据结构
+> Created Time:  Sat 17 Oct 2026 02:05:47 PM CST
+> Description:   升序链表（SortListTimer）、时间轮（TimeWheel）和时间堆（TimeHeap）都实现这个接口，
+                 使用者只通过TimerQueue操作定时器，在启动时用CreateTimerQueue按名字选择具体实现。
+ ************************************************************************/
+
+#ifndef TIMER_QUEUE
+#define TIMER_QUEUE
+
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include "Clock.h"
+#include "RingBuffer.h"
+
+struct ClientData;
+
+/*定时器回调函数*/
+typedef void (*TimerCallBack)(ClientData *);
+
+/*
+ * 侵入式定时器结点：直接嵌入在用户数据中，包含所有定时器组织结点所需的成员，
+ * 添加、调整和删除定时器都不需要分配内存，到期时也不会被释放
+ */
+class TimerNode
+{
+public:
+    TimerNode() : expire(0), userData(nullptr), callback(nullptr), prev(nullptr), next(nullptr),
+        slack(0), heapIndex(-1), level(0), timeSlot(0), pending(false) { }
+
+public:
+    int64_t expire;         //任务的超时时间，使用的是单调时钟的绝对时间（毫秒），已经按slack对齐
+    ClientData *userData;   //回调函数处理的客户数据，由定时器的调用者传递给回调函数
+    TimerCallBack callback; //任务回调函数
+    TimerNode *prev;        //升序链表和时间轮槽中的前一个定时器
+    TimerNode *next;        //升序链表和时间轮槽中的后一个定时器
+    int32_t slack;          //允许推迟到期的毫秒数，由调用者在添加之前设置，0表示准时到期
+    int32_t heapIndex;      //时间堆：结点在堆数组中的下标，不在堆中时为-1
+    int16_t level;          //时间轮：定时器属于哪一层
+    int16_t timeSlot;       //时间轮：定时器属于该层的哪个槽
+    bool pending;           //定时器是否在队列中等待到期
+};
+
+/*用户数据结构：定时器放在最前面，心跳时访问的定时器和socket描述符在同一个缓存行中，
+ *lastActive紧接着在下一个缓存行的开头。
+ *输入缓冲区只有收到数据时才分配内存，空闲的连接只占这个结构本身*/
+struct ClientData
+{
+    ClientData() : clntsock(-1), lastActive(0), clntAddr() { }
+
+    TimerNode timer;
+    int clntsock;
+    int64_t lastActive;     //最近一次收到数据的时刻（毫秒），惰性超时模式下定时器到期时据此决定是否重新计时
+    sockaddr_in clntAddr;
+    RingBuffer input;       //输入缓冲区
+};
+
+/*定时器结点增加成员时不能把socket描述符挤出第一个缓存行*/
+static_assert(sizeof(TimerNode) == 56, "TimerNode must stay 56 bytes");
+static_assert(offsetof(ClientData, clntsock) + sizeof(int) <= 64, "clntsock must share the timer's cache line");
+
+/*
+ * 定时器队列接口：定时器结点由调用者提供（通常嵌入在ClientData中），队列只负责把它们串起来，
+ * 从不分配或释放结点。定时器到期时先离开队列再执行回调，回调中可以重新添加它
+ */
+class TimerQueue
+{
+public:
+    virtual ~TimerQueue() { }
+    /*把定时器加入队列，在绝对时间expire（毫秒）到期，timer->slack不为0时按ApplySlack推迟。定时器已经在队列中时相当于AdjustTimer*/
+    virtual void AddTimer(TimerNode *timer, ClientData *userData, int64_t expire, TimerCallBack callback) = 0;
+    /*把队列中定时器的超时时间改为expire（同样按slack推迟），定时器不在队列中时什么也不做*/
+    virtual void AdjustTimer(TimerNode *timer, int64_t expire) = 0;
+    /*把定时器从队列中删除，不执行回调。定时器不在队列中时什么也不做*/
+    virtual void DeleteTimer(TimerNode *timer) = 0;
+    /*心跳函数：执行所有已经到期的定时任务*/
+    virtual void Tick() { TickTo(GetCurrentMs()); }
+    /*执行所有超时时间不晚于now（毫秒）的定时任务。调用者已经读过时钟时可以直接传入，压测时用它驱动虚拟时间*/
+    virtual void TickTo(int64_t now) = 0;
+    /*最近一个需要处理的时刻，队列为空时返回-1*/
+    virtual int64_t NextExpire() const = 0;
+};
+
+/*
+ * 定时器合并：把超时时间expire推迟到[expire, expire + slack]中末尾0最多的时刻（2的幂对齐），
+ * 与Linux早期定时器的apply_slack相同。不同时刻添加的、slack相近的定时器会落在同一个对齐的时刻上，
+ * 由同一次唤醒、同一次Tick处理，不再每个定时器单独唤醒一次。定时器从不提前到期。
+ * 对齐的边界是2的幂，时间轮上层的槽也按2的幂划分，合并后的定时器级联的时刻就是它到期的时刻，不会带来额外的唤醒
+ */
+inline int64_t ApplySlack(int64_t expire, int64_t slack)
+{
+    if ((slack <= 0) || (expire < 0))
+    {
+        return expire;
+    }
+    int64_t limit = expire + slack;
+    uint64_t mask = (uint64_t)(expire ^ limit);
+    if (mask == 0)
+    {
+        return expire;
+    }
+    /*expire和limit从最高的不同位往下清零，得到区间内最"整"的时刻*/
+    int bit = 63 - __builtin_clzll(mask);
+    return limit & ~(((int64_t)1 << bit) - 1);
+}
+
+/*
+ * 按名字创建定时器队列："list"、"wheel"或"heap"，名字无效时返回nullptr
+ */
+TimerQueue *CreateTimerQueue(const char *name);
+
+#endif
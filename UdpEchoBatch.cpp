@@ -0,0 +1,179 @@
+/* ************************************************************************
+> File Name:     UdpEchoBatch.cpp
+> Author:        Luncles
+> 功能：          用recvmmsg/sendmmsg批量处理UDP回声
+> Created Time:  Sun 18 Oct 2026 09:20:44 AM CST
+> Description:   
+ ************************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netinet/udp.h>
+#include "UdpEchoBatch.h"
+
+UdpEchoBatch::UdpEchoBatch() : gro(false), bufferSize(UDP_BUFFER_SIZE), buffers(nullptr)
+{
+    SetupBuffers();
+}
+
+UdpEchoBatch::~UdpEchoBatch()
+{
+    free(buffers);
+}
+
+void UdpEchoBatch::SetupBuffers()
+{
+    free(buffers);
+    buffers = (char *)malloc((size_t)UDP_BATCH_SIZE * bufferSize);
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < UDP_BATCH_SIZE; i++)
+    {
+        iovs[i].iov_base = buffers + (size_t)i * bufferSize;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+    }
+    ResetForRecv(UDP_BATCH_SIZE);
+}
+
+bool UdpEchoBatch::EnableGro(int udpsock)
+{
+    int on = 1;
+    if (setsockopt(udpsock, SOL_UDP, UDP_GRO, &on, sizeof(on)) == -1)
+    {
+        return false;
+    }
+    if (!gro)
+    {
+        gro = true;
+        bufferSize = UDP_GRO_BUFFER_SIZE;
+        SetupBuffers();
+    }
+    return true;
+}
+
+bool UdpEchoBatch::GroSupported()
+{
+    int sock = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return false;
+    }
+    int on = 1;
+    bool supported = (setsockopt(sock, SOL_UDP, UDP_GRO, &on, sizeof(on)) != -1);
+    close(sock);
+    return supported;
+}
+
+/*
+ * 接收时内核会改写msg_namelen、msg_controllen和msg_len，发送时iov_len被改成了数据报的长度，
+ * 控制消息被改成了UDP_SEGMENT，所以每轮接收前都要恢复
+ */
+void UdpEchoBatch::ResetForRecv(int num)
+{
+    for (int i = 0; i < num; i++)
+    {
+        iovs[i].iov_len = bufferSize;
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_flags = 0;
+        if (gro)
+        {
+            msgs[i].msg_hdr.msg_control = controls[i].buf;
+            msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].buf);
+        }
+    }
+}
+
+/*
+ * 合并的数据报带有UDP_GRO控制消息，值是原来每个数据报的大小（最后一个可能更短）。
+ * 回声时把它原样作为UDP_SEGMENT交给内核，切出来的数据报与收到的一一对应
+ */
+int UdpEchoBatch::PrepareEcho(int i)
+{
+    struct msghdr *hdr = &msgs[i].msg_hdr;
+    unsigned int len = msgs[i].msg_len;
+    int segSize = 0;
+    if (gro)
+    {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg))
+        {
+            if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO))
+            {
+                memcpy(&segSize, CMSG_DATA(cmsg), sizeof(segSize));
+                break;
+            }
+        }
+    }
+    iovs[i].iov_len = len;
+    if ((segSize <= 0) || (len <= (unsigned int)segSize))
+    {
+        hdr->msg_control = NULL;
+        hdr->msg_controllen = 0;
+        return 1;
+    }
+    uint16_t gsoSize = segSize;
+    hdr->msg_control = controls[i].buf;
+    hdr->msg_controllen = CMSG_SPACE(sizeof(gsoSize));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(gsoSize));
+    memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+    return (len + segSize - 1) / segSize;
+}
+
+int UdpEchoBatch::Drain(int udpsock, int budget)
+{
+    int total = 0;
+    while (total < budget)
+    {
+        int batch = (budget - total < UDP_BATCH_SIZE) ? (budget - total) : UDP_BATCH_SIZE;
+        int recvNum = recvmmsg(udpsock, msgs, batch, MSG_DONTWAIT, NULL);
+        if (recvNum <= 0)
+        {
+            //EAGAIN表示已经读完，其他错误（如ICMP不可达）也结束本次处理
+            break;
+        }
+
+        /*每个数据报只发回实际收到的字节数，合并的数据报按原来的大小切开发回*/
+        int datagrams = 0;
+        for (int i = 0; i < recvNum; i++)
+        {
+            datagrams += PrepareEcho(i);
+        }
+        int sent = 0;
+        while (sent < recvNum)
+        {
+            int ret = sendmmsg(udpsock, msgs + sent, recvNum - sent, MSG_DONTWAIT);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                //发送缓冲区满时丢弃剩下的回声，UDP本身不保证送达
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS))
+                {
+                    break;
+                }
+                //sendmmsg在第一个发送失败的消息处停下，只是这一个目的地有问题（不可达、无权限、太大等），
+                //跳过它，接着发其他对端的回声
+                sent++;
+                continue;
+            }
+            sent += ret;
+        }
+        total += datagrams;
+        ResetForRecv(recvNum);
+
+        /*没有收满一批，说明socket已经读空，不必再多做一次返回EAGAIN的系统调用*/
+        if (recvNum < batch)
+        {
+            break;
+        }
+    }
+    return total;
+}
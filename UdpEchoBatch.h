@@ -0,0 +1,69 @@
+/* ************************************************************************
+> File Name:     UdpEchoBatch.h
+> Author:        Luncles
+> 功能：          用recvmmsg/sendmmsg批量处理UDP回声
+> Created Time:  Sun 18 Oct 2026 09:20:44 AM CST
+> Description:   每个反应堆持有一个UdpEchoBatch，其中的缓冲区、地址和消息头数组都是复用的。
+                 一次recvmmsg最多收取UDP_BATCH_SIZE个数据报，再用一次sendmmsg把它们原样发回，
+                 每个数据报只发送实际收到的长度。
+                 可选的GRO模式：socket打开UDP_GRO后，内核把同一来源、同样大小的一串数据报合并成一个大缓冲区交上来，
+                 控制消息中带有原来每个数据报的大小；回声时在控制消息中带上UDP_SEGMENT（GSO），
+                 内核再按这个大小把缓冲区切回一个个数据报发出。一次系统调用、一次协议栈遍历处理几十个数据报。
+                 GRO模式下每个缓冲区要能放下64KB，一批共4MB，但这么大的内存是按页映射的，
+                 普通大小的数据报只用到每个缓冲区开头的一页，实际占用的内存与缓冲区的个数相当。
+ ************************************************************************/
+
+#ifndef UDP_ECHO_BATCH
+#define UDP_ECHO_BATCH
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#define UDP_BATCH_SIZE 64
+#define UDP_BUFFER_SIZE 1024
+#define UDP_GRO_BUFFER_SIZE 65536               //GRO模式下每个缓冲区的大小，放得下合并后最大的数据报
+#define UDP_READ_BUDGET (4 * UDP_BATCH_SIZE)    //一次Drain最多回声的数据报数，UDP洪水不能饿死TCP连接
+
+class UdpEchoBatch
+{
+public:
+    UdpEchoBatch();
+    ~UdpEchoBatch();
+    UdpEchoBatch(const UdpEchoBatch &) = delete;
+    UdpEchoBatch &operator=(const UdpEchoBatch &) = delete;
+    /*在udpsock上打开UDP_GRO并切换到GRO模式，内核不支持时返回false，保持逐个数据报的模式。
+     *多个反应堆共享同一个socket时每个反应堆都要调用*/
+    bool EnableGro(int udpsock);
+    /*用一个临时的UDP socket检查内核是否支持UDP_GRO，在创建反应堆之前调用一次，所有反应堆用同一种模式*/
+    static bool GroSupported();
+    /*把udpsock上的数据报读出并回声，直到返回EAGAIN或者达到budget个，返回回声的数据报数（合并的数据报按原来的个数计）。
+     *返回值达到budget时socket上可能还有数据报*/
+    int Drain(int udpsock, int budget);
+
+private:
+    /*按bufferSize分配缓冲区，并把消息头指向它们*/
+    void SetupBuffers();
+    /*把第0~num-1个消息头恢复为接收状态*/
+    void ResetForRecv(int num);
+    /*第i个消息是合并的数据报时，把它的控制消息改写为UDP_SEGMENT，返回它包含的数据报数*/
+    int PrepareEcho(int i);
+
+private:
+    /*控制消息的缓冲区，按cmsghdr对齐*/
+    union Control
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    };
+
+    bool gro;                                       //是否是GRO模式
+    int bufferSize;                                 //每个消息的缓冲区大小
+    char *buffers;                                  //每个消息一个缓冲区，连续分配
+    struct sockaddr_in addrs[UDP_BATCH_SIZE];       //数据报的源地址，也是回声的目的地址
+    struct iovec iovs[UDP_BATCH_SIZE];
+    struct mmsghdr msgs[UDP_BATCH_SIZE];
+    Control controls[UDP_BATCH_SIZE];               //GRO模式：接收时是UDP_GRO，发送时是UDP_SEGMENT
+};
+
+#endif
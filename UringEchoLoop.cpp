@@ -0,0 +1,544 @@
+/* ************************************************************************
+> File Name:     UringEchoLoop.cpp
+> Author:        Luncles
+> 功能：          基于io_uring的TCP/UDP回声事件循环的实现
+> Created Time:  Thu 22 Oct 2026 03:58:14 PM CST
+> Description:   每个请求的user_data低3位是请求类型，其余位是连接指针（UDP发送是缓冲区编号），
+                 UringConn由new分配，至少8字节对齐，低3位总是0
+ ************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "init_socket.h"
+#include "UringEchoLoop.h"
+
+#define NO_BUFFER 0xFFFF        //发送队列的结束标记
+#define MAX_SEND_CHAIN 32       //一条发送链最多包含的缓冲区数
+
+enum RequestType
+{
+    REQ_ACCEPT = 1,
+    REQ_RECV,
+    REQ_SEND,
+    REQ_CANCEL,
+    REQ_UDP_RECV,
+    REQ_UDP_SEND,
+    REQ_SIGNAL
+};
+
+static inline uint64_t MakeUserData(void *ptr, int type)
+{
+    return (uint64_t)(uintptr_t)ptr | type;
+}
+
+UringEchoLoop::UringEchoLoop(int servsock, int udpsock, int sigfd, LoopStats *stats, void (*onSignal)()) :
+    servsock(servsock), udpsock(udpsock), sigfd(sigfd), stats(stats), onSignal(onSignal),
+    buffersRecycled(false), udpInFlight(0), udpArmed(false)
+{
+    memset(&udpRecvMsg, 0, sizeof(udpRecvMsg));
+    /*多次触发的recvmsg把源地址放在每个缓冲区的头部之后，这里只需要给出地址的长度*/
+    udpRecvMsg.msg_namelen = sizeof(struct sockaddr_in);
+}
+
+UringEchoLoop::~UringEchoLoop()
+{
+}
+
+bool UringEchoLoop::Init()
+{
+    /*依次尝试：只有本线程提交并把完成处理推迟到等待时（最少的中断），协作式完成处理，默认*/
+    const unsigned setupFlags[] = { IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, IORING_SETUP_COOP_TASKRUN, 0 };
+    bool created = false;
+    for (size_t i = 0; !created && (i < sizeof(setupFlags) / sizeof(setupFlags[0])); i++)
+    {
+        created = ring.Init(URING_ENTRIES, setupFlags[i]);
+    }
+    if (!created)
+    {
+        return false;
+    }
+    if (!tcpBuffers.Init(ring, 0, TCP_BUFFER_COUNT, TCP_RING_BUFFER_SIZE))
+    {
+        return false;
+    }
+    unsigned udpSize = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + UDP_BUFFER_SIZE;
+    if (!udpBuffers.Init(ring, 1, UDP_BUFFER_COUNT, udpSize))
+    {
+        return false;
+    }
+    ArmAccept();
+    ArmUdpRecv();
+    if (sigfd >= 0)
+    {
+        ArmSignalRead();
+    }
+    return true;
+}
+
+bool UringEchoLoop::Supported()
+{
+    IoUring testRing;
+    BufferRing testBuffers;
+    if (!testRing.Init(8, 0) || !testBuffers.Init(testRing, 0, 8, 64))
+    {
+        return false;
+    }
+    /*在socketpair上挂一个多次触发、自选缓冲区的recv，写入一个字节，看完成事件是否带着缓冲区并且recv仍然有效*/
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        return false;
+    }
+    struct io_uring_sqe *sqe = testRing.GetSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = 1;
+    bool ok = false;
+    if ((write(sv[1], "x", 1) == 1) && (testRing.SubmitAndWait(1) >= 0))
+    {
+        struct io_uring_cqe *cqe = testRing.PeekCqe();
+        ok = cqe && (cqe->res == 1) && (cqe->flags & IORING_CQE_F_BUFFER) && (cqe->flags & IORING_CQE_F_MORE);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    return ok;
+}
+
+struct io_uring_sqe *UringEchoLoop::NextSqe()
+{
+    struct io_uring_sqe *sqe;
+    while (!(sqe = ring.GetSqe()))
+    {
+        ring.SubmitAndWait(0);
+    }
+    return sqe;
+}
+
+void UringEchoLoop::ArmAccept()
+{
+    struct io_uring_sqe *sqe = NextSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = servsock;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = MakeUserData(nullptr, REQ_ACCEPT);
+}
+
+void UringEchoLoop::ArmRecv(UringConn *conn)
+{
+    struct io_uring_sqe *sqe = NextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = tcpBuffers.GroupId();
+    sqe->user_data = MakeUserData(conn, REQ_RECV);
+    conn->recvArmed = true;
+}
+
+void UringEchoLoop::ArmUdpRecv()
+{
+    struct io_uring_sqe *sqe = NextSqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = udpsock;
+    sqe->addr = (uint64_t)(uintptr_t)&udpRecvMsg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = udpBuffers.GroupId();
+    sqe->user_data = MakeUserData(nullptr, REQ_UDP_RECV);
+    udpArmed = true;
+}
+
+/*
+ * signalfd上挂多次触发的poll，可读时和epoll后端一样用read读出
+ */
+void UringEchoLoop::ArmSignalRead()
+{
+    struct io_uring_sqe *sqe = NextSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = sigfd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = MakeUserData(nullptr, REQ_SIGNAL);
+}
+
+/*
+ * 发送链：除最后一个之外的发送都带IOSQE_IO_LINK，前一个完成后才开始下一个，一个失败时后面的都以ECANCELED结束。
+ * MSG_WAITALL让内核把每个缓冲区发完才算完成，部分发送不会打断链。整条链必须在同一次提交中，所以先确保提交队列有足够的空位
+ */
+void UringEchoLoop::SubmitSends(UringConn *conn)
+{
+    if (conn->closing || (conn->sendsInFlight > 0) || (conn->head == NO_BUFFER))
+    {
+        return;
+    }
+    int chainLen = (conn->queued < MAX_SEND_CHAIN) ? conn->queued : MAX_SEND_CHAIN;
+    if (ring.SpaceLeft() < (unsigned)chainLen)
+    {
+        ring.SubmitAndWait(0);
+    }
+    uint16_t bufferId = conn->head;
+    for (int i = 0; i < chainLen; i++)
+    {
+        struct io_uring_sqe *sqe = NextSqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->fd;
+        sqe->addr = (uint64_t)(uintptr_t)tcpBuffers.Buffer(bufferId);
+        sqe->len = bufferLen[bufferId];
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        sqe->user_data = MakeUserData(conn, REQ_SEND);
+        if (i < chainLen - 1)
+        {
+            sqe->flags = IOSQE_IO_LINK;
+        }
+        conn->sendsInFlight++;
+        bufferId = bufferNext[bufferId];
+    }
+}
+
+void UringEchoLoop::PauseRecv(UringConn *conn)
+{
+    if (!conn->recvArmed || conn->paused)
+    {
+        return;
+    }
+    conn->paused = true;
+    conn->cancelInFlight = true;
+    struct io_uring_sqe *sqe = NextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = MakeUserData(conn, REQ_RECV);
+    sqe->user_data = MakeUserData(conn, REQ_CANCEL);
+}
+
+/*
+ * 暂停的连接在排队的缓冲区足够少、旧的recv和取消请求都已结束后重新挂上recv
+ */
+static inline bool CanResume(const UringConn *conn)
+{
+    return conn->paused && !conn->closing && !conn->inputClosed && (conn->queued <= CONN_RESUME_BUFFERS) && !conn->recvArmed &&
+        !conn->cancelInFlight && !conn->waitingBuffers;
+}
+
+void UringEchoLoop::PopBuffer(UringConn *conn)
+{
+    uint16_t bufferId = conn->head;
+    conn->head = bufferNext[bufferId];
+    if (conn->head == NO_BUFFER)
+    {
+        conn->tail = NO_BUFFER;
+    }
+    conn->queued--;
+    tcpBuffers.Recycle(bufferId);
+    buffersRecycled = true;
+}
+
+void UringEchoLoop::TryFinish(UringConn *conn)
+{
+    if (!conn->closing || conn->recvArmed || (conn->sendsInFlight > 0) || conn->cancelInFlight || conn->waitingBuffers)
+    {
+        return;
+    }
+    while (conn->head != NO_BUFFER)
+    {
+        PopBuffer(conn);
+    }
+    close(conn->fd);
+    delete conn;
+}
+
+void UringEchoLoop::AddConnection(int clntsock)
+{
+    UringConn *conn = new UringConn();
+    conn->fd = clntsock;
+    conn->head = conn->tail = NO_BUFFER;
+    conn->queued = 0;
+    conn->sendsInFlight = 0;
+    conn->recvArmed = false;
+    conn->cancelInFlight = false;
+    conn->paused = false;
+    conn->waitingBuffers = false;
+    conn->inputClosed = false;
+    conn->closing = false;
+    ArmRecv(conn);
+}
+
+void UringEchoLoop::OnAccept(int clntsock, struct sockaddr_in &, void *arg)
+{
+    ((UringEchoLoop *)arg)->AddConnection(clntsock);
+}
+
+void UringEchoLoop::HandleAccept(struct io_uring_cqe *cqe)
+{
+    if (cqe->res >= 0)
+    {
+        AddConnection(cqe->res);
+    }
+    else if ((cqe->res == -EMFILE) || (cqe->res == -ENFILE))
+    {
+        /*描述符耗尽时积压队列中的连接不会被取走，交给AcceptConnections用预留的描述符拒绝掉*/
+        AcceptConnections(servsock, ACCEPT_BUDGET, OnAccept, this);
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        ArmAccept();
+    }
+}
+
+void UringEchoLoop::HandleRecv(UringConn *conn, struct io_uring_cqe *cqe)
+{
+    int res = cqe->res;
+    if (res > 0)
+    {
+        uint16_t bufferId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (conn->closing)
+        {
+            tcpBuffers.Recycle(bufferId);
+            buffersRecycled = true;
+        }
+        else
+        {
+            /*追加到发送队列的末尾*/
+            bufferLen[bufferId] = res;
+            bufferNext[bufferId] = NO_BUFFER;
+            if (conn->tail == NO_BUFFER)
+            {
+                conn->head = bufferId;
+            }
+            else
+            {
+                bufferNext[conn->tail] = bufferId;
+            }
+            conn->tail = bufferId;
+            conn->queued++;
+            SubmitSends(conn);
+            if (conn->queued > CONN_MAX_BUFFERS)
+            {
+                PauseRecv(conn);
+            }
+        }
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        /*多次触发的recv结束了：对端关闭写时不再接收，队列中的回声发完再关闭；出错时关闭连接，
+         *缓冲区耗尽时等待，被取消时等待恢复，否则重新挂上*/
+        conn->recvArmed = false;
+        if (res == 0)
+        {
+            conn->inputClosed = true;
+            if (conn->head == NO_BUFFER)
+            {
+                conn->closing = true;
+            }
+        }
+        else if ((res < 0) && (res != -ENOBUFS) && (res != -ECANCELED))
+        {
+            conn->closing = true;
+        }
+        else if (res == -ENOBUFS)
+        {
+            if (!conn->closing && !conn->waitingBuffers)
+            {
+                conn->waitingBuffers = true;
+                waiting.push_back(conn);
+            }
+        }
+        else if ((res > 0) && !conn->paused && !conn->closing)
+        {
+            ArmRecv(conn);
+        }
+    }
+    if (CanResume(conn))
+    {
+        conn->paused = false;
+        ArmRecv(conn);
+    }
+    TryFinish(conn);
+}
+
+void UringEchoLoop::HandleSend(UringConn *conn, struct io_uring_cqe *cqe)
+{
+    int len = bufferLen[conn->head];
+    PopBuffer(conn);
+    conn->sendsInFlight--;
+    if ((cqe->res != len) && !conn->closing)
+    {
+        /*发送出错（或者因为链中前面的发送出错而被取消）：关闭连接，shutdown让还挂着的recv立即结束*/
+        conn->closing = true;
+        if (conn->recvArmed)
+        {
+            shutdown(conn->fd, SHUT_RDWR);
+        }
+    }
+    if (conn->sendsInFlight == 0)
+    {
+        SubmitSends(conn);
+        if (CanResume(conn))
+        {
+            conn->paused = false;
+            ArmRecv(conn);
+        }
+    }
+    /*对端已经半关闭，最后的回声发完了*/
+    if (conn->inputClosed && !conn->closing && (conn->head == NO_BUFFER))
+    {
+        conn->closing = true;
+    }
+    TryFinish(conn);
+}
+
+void UringEchoLoop::HandleCancel(UringConn *conn)
+{
+    conn->cancelInFlight = false;
+    if (CanResume(conn))
+    {
+        conn->paused = false;
+        ArmRecv(conn);
+    }
+    TryFinish(conn);
+}
+
+void UringEchoLoop::RearmWaiting()
+{
+    std::vector<UringConn *> conns;
+    conns.swap(waiting);
+    for (size_t i = 0; i < conns.size(); i++)
+    {
+        UringConn *conn = conns[i];
+        conn->waitingBuffers = false;
+        if (conn->closing)
+        {
+            TryFinish(conn);
+        }
+        else if (!conn->paused)
+        {
+            ArmRecv(conn);
+        }
+        else if (CanResume(conn))
+        {
+            conn->paused = false;
+            ArmRecv(conn);
+        }
+    }
+}
+
+/*
+ * UDP数据报在缓冲区中的布局：io_uring_recvmsg_out头部、源地址（msg_namelen字节）、数据。
+ * 用这个缓冲区中的地址和数据拼出sendmsg的消息头原样发回，发送完成后缓冲区才放回环中
+ */
+void UringEchoLoop::HandleUdpRecv(struct io_uring_cqe *cqe)
+{
+    if ((cqe->res >= 0) && (cqe->flags & IORING_CQE_F_BUFFER))
+    {
+        uint16_t bufferId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char *buffer = udpBuffers.Buffer(bufferId);
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+        char *name = buffer + sizeof(*out);
+        char *payload = name + udpRecvMsg.msg_namelen + udpRecvMsg.msg_controllen;
+        size_t room = udpBuffers.BufferSize() - (payload - buffer);
+
+        struct msghdr *msg = &udpSendMsgs[bufferId];
+        struct iovec *iov = &udpSendIovs[bufferId];
+        iov->iov_base = payload;
+        iov->iov_len = (out->payloadlen < room) ? out->payloadlen : room;
+        memset(msg, 0, sizeof(*msg));
+        msg->msg_name = name;
+        msg->msg_namelen = (out->namelen < udpRecvMsg.msg_namelen) ? out->namelen : udpRecvMsg.msg_namelen;
+        msg->msg_iov = iov;
+        msg->msg_iovlen = 1;
+
+        struct io_uring_sqe *sqe = NextSqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = udpsock;
+        sqe->addr = (uint64_t)(uintptr_t)msg;
+        sqe->user_data = ((uint64_t)bufferId << 3) | REQ_UDP_SEND;
+        udpInFlight++;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        /*在一轮事件处理结束、有空闲缓冲区时重新挂上*/
+        udpArmed = false;
+    }
+}
+
+void UringEchoLoop::HandleUdpSend(struct io_uring_cqe *cqe)
+{
+    udpBuffers.Recycle((uint16_t)(cqe->user_data >> 3));
+    udpInFlight--;
+}
+
+void UringEchoLoop::HandleSignal(struct io_uring_cqe *cqe)
+{
+    if (cqe->res > 0)
+    {
+        while (read(sigfd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
+        {
+            onSignal();
+        }
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        ArmSignalRead();
+    }
+}
+
+/*
+ * 事件循环：一次io_uring_enter提交上一轮准备好的全部请求并等待至少一个完成事件，然后处理所有完成事件
+ */
+void UringEchoLoop::Run()
+{
+    while (1)
+    {
+        int ret = ring.SubmitAndWait(1);
+        if ((ret < 0) && (errno != EINTR) && (errno != EBUSY))
+        {
+            printf("io_uring failure\n");
+            break;
+        }
+
+        int cqeNum = 0;
+        uint64_t handlerStart = NowNs();
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring.PeekCqe()) != nullptr)
+        {
+            int type = (int)(cqe->user_data & 7);
+            UringConn *conn = (UringConn *)(uintptr_t)(cqe->user_data & ~(uint64_t)7);
+            switch (type)
+            {
+                case REQ_ACCEPT: HandleAccept(cqe); break;
+                case REQ_RECV: HandleRecv(conn, cqe); break;
+                case REQ_SEND: HandleSend(conn, cqe); break;
+                case REQ_CANCEL: HandleCancel(conn); break;
+                case REQ_UDP_RECV: HandleUdpRecv(cqe); break;
+                case REQ_UDP_SEND: HandleUdpSend(cqe); break;
+                case REQ_SIGNAL: HandleSignal(cqe); break;
+                default: break;
+            }
+            ring.SeenCqe();
+            cqeNum++;
+            uint64_t handlerEnd = NowNs();
+            stats->handlerNs.Record(handlerEnd - handlerStart);
+            handlerStart = handlerEnd;
+        }
+        stats->batchSize.Record(cqeNum);
+
+        /*本轮放回的缓冲区一次发布给内核，再重新挂上等待缓冲区的recv*/
+        tcpBuffers.Commit();
+        udpBuffers.Commit();
+        if (buffersRecycled && !waiting.empty())
+        {
+            RearmWaiting();
+        }
+        buffersRecycled = false;
+        if (!udpArmed && (udpInFlight < UDP_BUFFER_COUNT))
+        {
+            ArmUdpRecv();
+        }
+    }
+}
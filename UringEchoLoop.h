@@ -0,0 +1,117 @@
+/* ************************************************************************
+> File Name:     UringEchoLoop.h
+> Author:        Luncles
+> 功能：          基于io_uring的TCP/UDP回声事件循环，TCPandUDPServer的另一种后端
+> Created Time:  Thu 22 Oct 2026 02:36:50 PM CST
+> Description:   每个反应堆线程一个环。监听socket上挂一个多次触发的accept（IORING_ACCEPT_MULTISHOT），
+                 每个连接上挂一个多次触发的recv（IORING_RECV_MULTISHOT），数据由内核放进提供缓冲区环中的缓冲区，
+                 回声直接从这个缓冲区发出，发完再把缓冲区放回环中，没有任何复制。同一个连接上一次收割到的
+                 多个缓冲区以IOSQE_IO_LINK串成一条发送链，保证按顺序发送；上一条链完成之前新收到的缓冲区
+                 在连接的队列里等待。UDP用多次触发的recvmsg收取，sendmsg原样发回。
+                 所有请求都在一次io_uring_enter中提交，并在同一次调用中等待完成事件，一轮事件循环只有
+                 一次系统调用。一个连接排队的缓冲区超过CONN_MAX_BUFFERS时取消它的recv（背压），
+                 降到CONN_RESUME_BUFFERS以下再重新挂上；缓冲区环被取空时，recv以ENOBUFS结束，
+                 等有缓冲区放回后再重新挂上。对端半关闭（recv返回0）时不再接收，队列中的缓冲区全部发完后才关闭连接。
+ ************************************************************************/
+
+#ifndef URING_ECHO_LOOP
+#define URING_ECHO_LOOP
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/signalfd.h>
+#include <vector>
+#include "IoUring.h"
+#include "UdpEchoBatch.h"
+#include "Histogram.h"
+
+#define URING_ENTRIES 1024          //提交队列的大小
+#define TCP_BUFFER_COUNT 1024       //TCP缓冲区环中的缓冲区数，必须是2的幂
+#define TCP_RING_BUFFER_SIZE 2048   //每个TCP缓冲区的大小
+#define UDP_BUFFER_COUNT 256        //UDP缓冲区环中的缓冲区数，必须是2的幂
+#define CONN_MAX_BUFFERS 16         //一个连接排队的缓冲区超过它时暂停接收
+#define CONN_RESUME_BUFFERS 4       //降到它以下时恢复接收
+
+/*io_uring后端的一个TCP连接*/
+struct UringConn
+{
+    int fd;
+    uint16_t head;          //等待发送的缓冲区队列，按接收顺序用缓冲区编号串成链表
+    uint16_t tail;
+    int queued;             //队列中的缓冲区数，包括正在发送的
+    int sendsInFlight;      //已经提交、还没有完成的发送数，它们是队列的前sendsInFlight个缓冲区
+    bool recvArmed;         //多次触发的recv是否还在
+    bool cancelInFlight;    //取消recv的请求是否还没有完成
+    bool paused;            //是否因为排队过多而暂停接收
+    bool waitingBuffers;    //recv因为缓冲区环为空而结束，等待重新挂上
+    bool inputClosed;       //对端已经关闭写（recv返回0），队列中的回声发完后结束连接
+    bool closing;           //连接已经结束，等所有请求完成后关闭
+};
+
+class UringEchoLoop
+{
+public:
+    /*servsock、udpsock由反应堆提供，sigfd为-1表示不处理信号，收到信号时调用onSignal*/
+    UringEchoLoop(int servsock, int udpsock, int sigfd, LoopStats *stats, void (*onSignal)());
+    ~UringEchoLoop();
+    /*在运行事件循环的线程中调用：创建环、注册缓冲区环并挂上accept、UDP和信号的请求。失败时返回false*/
+    bool Init();
+    /*事件循环，出错时返回*/
+    void Run();
+    /*检查内核是否支持这个后端需要的全部特性（提供缓冲区环、多次触发的recv），不支持时返回false*/
+    static bool Supported();
+
+private:
+    /*取一个SQE，提交队列满时先提交*/
+    struct io_uring_sqe *NextSqe();
+    void ArmAccept();
+    void ArmRecv(UringConn *conn);
+    void ArmUdpRecv();
+    void ArmSignalRead();
+    /*把连接队列中还没有发送的缓冲区串成一条发送链提交*/
+    void SubmitSends(UringConn *conn);
+    /*排队太多时取消连接的recv*/
+    void PauseRecv(UringConn *conn);
+    /*连接结束且没有未完成的请求时关闭它*/
+    void TryFinish(UringConn *conn);
+    /*把连接队列头部的缓冲区放回缓冲区环*/
+    void PopBuffer(UringConn *conn);
+
+    void HandleAccept(struct io_uring_cqe *cqe);
+    void HandleRecv(UringConn *conn, struct io_uring_cqe *cqe);
+    void HandleSend(UringConn *conn, struct io_uring_cqe *cqe);
+    void HandleCancel(UringConn *conn);
+    void HandleUdpRecv(struct io_uring_cqe *cqe);
+    void HandleUdpSend(struct io_uring_cqe *cqe);
+    void HandleSignal(struct io_uring_cqe *cqe);
+    /*有缓冲区放回后，重新挂上因为ENOBUFS结束的recv*/
+    void RearmWaiting();
+
+    static void OnAccept(int clntsock, struct sockaddr_in &clntAddr, void *arg);
+    void AddConnection(int clntsock);
+
+private:
+    int servsock;
+    int udpsock;
+    int sigfd;
+    LoopStats *stats;
+    void (*onSignal)();
+
+    IoUring ring;
+    BufferRing tcpBuffers;
+    BufferRing udpBuffers;
+    uint16_t bufferNext[TCP_BUFFER_COUNT];      //连接发送队列中下一个缓冲区的编号
+    int bufferLen[TCP_BUFFER_COUNT];            //缓冲区中数据的长度
+    bool buffersRecycled;                       //本轮是否有TCP缓冲区放回
+    std::vector<UringConn *> waiting;           //因为ENOBUFS等待重新挂recv的连接
+
+    struct msghdr udpRecvMsg;                   //多次触发recvmsg的模板，只用到地址长度
+    struct msghdr udpSendMsgs[UDP_BUFFER_COUNT];//每个UDP缓冲区回声时用的消息头
+    struct iovec udpSendIovs[UDP_BUFFER_COUNT];
+    int udpInFlight;                            //正在回声的UDP缓冲区数
+    bool udpArmed;
+    struct signalfd_siginfo siginfo;
+};
+
+#endif
@@ -12,9 +12,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
-#include <sys/epoll.h>
 #include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "init_socket.h"
+#include "Clock.h"
 
 /*
  * 功能：初始化socket地址
@@ -40,15 +43,109 @@ int SetNonblocking(int fd)
 }
 
 /*
- * 功能：将描述符注册到epoll事件集中
+ * 功能：设置SO_REUSEPORT，使多个socket可以绑定同一个地址和端口，由内核在它们之间分发连接和数据报，
+ *       必须在bind之前调用。内核不支持时返回-1
  */
- void addfd(int &epollfd, int &fd)
- {
-    epoll_event event;
-    event.data.fd = fd;
-    event.events = EPOLLIN | EPOLLET;      //设置为边缘触发
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    SetNonblocking(fd);
- }
-
- 
\ No newline at end of file
+int SetReusePort(int fd)
+{
+    int on = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+}
+
+/*
+ * 非阻塞的读在接收队列为空时先轮询一次网卡的收包队列，SO_PREFER_BUSY_POLL让内核在应用持续轮询时推迟网卡中断，
+ * 收包全部由轮询完成
+ */
+int SetBusyPoll(int fd, int usec)
+{
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1)
+    {
+        return -1;
+    }
+    return setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+}
+
+/*
+ * 预留的空闲描述符：进程描述符耗尽（EMFILE/ENFILE）时先关闭它腾出一个位置，接受积压中的连接后立即关闭，
+ * 再重新占住这个位置。否则连接一直留在积压队列里，水平触发的监听socket会让epoll_wait不停返回。
+ * 所有反应堆共用一个预留描述符，第一次由pthread_once打开，之后只在reserveLocker保护下关闭和重新打开
+ */
+static int reserveFd = -1;
+static pthread_once_t reserveOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t reserveLocker = PTHREAD_MUTEX_INITIALIZER;
+/*描述符耗尽时每个被拒绝的连接都打印一行会刷屏，改为最多每REJECT_REPORT_MS毫秒汇总打印一次*/
+static const int64_t REJECT_REPORT_MS = 1000;
+static uint64_t rejectedNum = 0;            //上次打印之后拒绝的连接数，由reserveLocker保护
+static int64_t lastRejectReport = 0;
+
+static void OpenReserveFd()
+{
+    reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static void RejectOneConnection(int servsock)
+{
+    pthread_mutex_lock(&reserveLocker);
+    if (reserveFd < 0)
+    {
+        reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    if (reserveFd >= 0)
+    {
+        close(reserveFd);
+        int clntsock = accept(servsock, NULL, NULL);
+        if (clntsock >= 0)
+        {
+            close(clntsock);
+            rejectedNum++;
+        }
+        reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    int64_t now = MonotonicMs();
+    if ((rejectedNum > 0) && (now - lastRejectReport >= REJECT_REPORT_MS))
+    {
+        printf("too many open files, rejected %llu connections\n", (unsigned long long)rejectedNum);
+        rejectedNum = 0;
+        lastRejectReport = now;
+    }
+    pthread_mutex_unlock(&reserveLocker);
+}
+
+/*
+ * 功能：从非阻塞的监听socket上循环接受连接，直到积压队列为空或者达到budget个，对每个连接调用callback，
+ *       返回接受的连接数。accept4直接创建非阻塞、close-on-exec的socket，每个连接少两次fcntl
+ */
+int AcceptConnections(int servsock, int budget, AcceptCallBack callback, void *arg)
+{
+    /*第一次调用时占住预留描述符，此时进程一般还没有用完描述符。这里不读reserveFd，其他反应堆可能正在关闭和重新打开它*/
+    pthread_once(&reserveOnce, OpenReserveFd);
+
+    int accepted = 0;
+    /*被拒绝和被中断的尝试同样计入budget，保证这个循环一定会结束*/
+    for (int i = 0; i < budget; i++)
+    {
+        struct sockaddr_in clntAddr;
+        socklen_t clntAddrSize = sizeof(clntAddr);
+        int clntsock = accept4(servsock, (struct sockaddr *)&clntAddr, &clntAddrSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clntsock < 0)
+        {
+            if ((errno == EINTR) || (errno == ECONNABORTED) || (errno == EPROTO))
+            {
+                //连接在被接受前已经被对端重置，继续接受下一个
+                continue;
+            }
+            if ((errno == EMFILE) || (errno == ENFILE))
+            {
+                RejectOneConnection(servsock);
+                continue;
+            }
+            //EAGAIN：积压队列已空；共享监听socket时连接也可能被其他反应堆取走
+            break;
+        }
+        accepted++;
+        callback(clntsock, clntAddr, arg);
+    }
+    return accepted;
+}
+
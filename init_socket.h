@@ -6,6 +6,18 @@
 > Description:   
  ************************************************************************/
 
+#include <netinet/in.h>
+
+/*每次监听socket可读时最多接受的连接数，超出的部分留到下一轮epoll_wait，避免连接风暴饿死已有连接*/
+const int ACCEPT_BUDGET = 256;
+
+/*AcceptConnections每接受一个连接调用一次，clntsock已经是非阻塞并带有close-on-exec标志的*/
+typedef void (*AcceptCallBack)(int clntsock, struct sockaddr_in &clntAddr, void *arg);
+
 void InitSocketAddress(struct sockaddr_in &address, const char *ip, const char *port);
 int SetNonblocking(int fd);
-void addfd(int &epollfd, int &fd);
\ No newline at end of file
+int SetReusePort(int fd);
+/*打开socket的内核忙轮询（SO_BUSY_POLL和SO_PREFER_BUSY_POLL），accept得到的连接继承这个设置。
+ *只对支持NAPI的网卡有效，回环接口上没有效果。超过net.core.busy_read时需要CAP_NET_ADMIN，失败时返回-1*/
+int SetBusyPoll(int fd, int usec);
+int AcceptConnections(int servsock, int budget, AcceptCallBack callback, void *arg);